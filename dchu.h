@@ -3,12 +3,165 @@
 #define _DCHU_H
 
 #include <linux/acpi.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/workqueue.h>
+#include <linux/notifier.h>
+
+#define DCHU_DSM_PAYLOAD_MAX 16    /* largest payload a query can be keyed on */
+#define DCHU_DSM_BUF_MAX     256   /* buffer bytes kept per shared result */
+#define DCHU_DSM_SLOTS       4     /* distinct queries remembered */
+#define DCHU_DSM_OUT_MAX     1024  /* preallocated ACPI result buffer */
+#define DCHU_DSM_BATCH_MAX   16    /* requests per dchu_call_dsm_batch() */
+#define DCHU_DSM_FUNCS       256   /* function ids covered by the _DSM 0 bitmap */
+
+/*
+ * EC event codes passed to dchu_register_notifier() callbacks as the
+ * action. Clevo numbering; firmware notifies 0x80 and the code is read
+ * back with _DSM 1, otherwise the notify value itself is the code.
+ */
+#define DCHU_EVENT_NOTIFY          0x80
+#define DCHU_EVENT_KBD_DOWN        0x81
+#define DCHU_EVENT_KBD_UP          0x82
+#define DCHU_EVENT_KBD_CYCLE       0x8a
+#define DCHU_EVENT_KBD_TOGGLE      0x9f
+#define DCHU_EVENT_KBD_DOWN2       0x20
+#define DCHU_EVENT_KBD_UP2         0x21
+#define DCHU_EVENT_KBD_TOGGLE2     0x3f
+#define DCHU_EVENT_TOUCHPAD        0x5d
+#define DCHU_EVENT_TOUCHPAD_OFF    0xfc
+#define DCHU_EVENT_TOUCHPAD_ON     0xfd
+#define DCHU_EVENT_RFKILL          0x85
+#define DCHU_EVENT_RFKILL2         0x86
+
+/* The EC changed the keyboard backlight on its own */
+static inline bool dchu_event_kbd_light(unsigned long code)
+{
+    switch (code) {
+    case DCHU_EVENT_KBD_DOWN: case DCHU_EVENT_KBD_UP:
+    case DCHU_EVENT_KBD_CYCLE: case DCHU_EVENT_KBD_TOGGLE:
+    case DCHU_EVENT_KBD_DOWN2: case DCHU_EVENT_KBD_UP2:
+    case DCHU_EVENT_KBD_TOGGLE2:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* _DSM 121 fan modes */
+#define DCHU_FAN_MODE_AUTO   0
+#define DCHU_FAN_MODE_MAX    1
+#define DCHU_FAN_MODE_SILENT 3
+#define DCHU_FAN_MODE_CUSTOM 6
+
+static inline void dchu_fan_mode_payload(u8 *payload, u8 mode)
+{
+    payload[0] = mode; /* data */
+    payload[1] = 0;
+    payload[2] = 0;
+    payload[3] = 1;    /* subcommand */
+}
+
+/* Fan package decoding, shared by dchu_hwmon and dchu_kunit */
+static inline u16 dchu_get16(const u8 *b, int hi, bool le)
+{
+    /* bytes at [hi] (MSB) and [hi+1] (LSB) in the parse table */
+    return le ? (u16)(((u16)b[hi] << 8) | b[hi + 1])
+              : (u16)(((u16)b[hi + 1] << 8) | b[hi]);
+}
+
+static inline long dchu_to_rpm(u16 raw, bool invert, u32 tach_hz, u32 ppr)
+{
+    if (!invert)
+        return (long)raw;
+    if (!raw || !tach_hz || !ppr)
+        return 0;
+    return (long)DIV_ROUND_CLOSEST_ULL((u64)tach_hz * 60ULL,
+                                       (u64)ppr * (u64)raw);
+}
+
+/* Typed copy of a _DSM result into caller storage */
+struct dchu_dsm_res {
+    acpi_object_type type;     /* ACPI_TYPE_INTEGER/_BUFFER/_PACKAGE */
+    u64 integer;               /* ACPI_TYPE_INTEGER value */
+    u8 *buf;                   /* caller buffer for ACPI_TYPE_BUFFER, may be NULL */
+    u32 size;                  /* capacity of buf */
+    u32 len;                   /* buffer length or package count, may exceed size */
+};
+
+/* One request of a dchu_call_dsm_batch() */
+struct dchu_dsm_req {
+    u64 function;
+    const u8 *payload;
+    u32 payload_len;
+    struct dchu_dsm_res res;   /* out; buffer results go to res.buf, or the arena if NULL */
+    int ret;                   /* out: 0 or -errno of this evaluation */
+    u64 duration_ns;           /* out: time spent in the firmware */
+};
+
+/* Last result of one {function, payload} query, shared by concurrent readers */
+struct dchu_dsm_slot {
+    bool used;
+    bool valid;                /* holds the result of evaluation idx */
+    u64 function;
+    u32 payload_len;
+    u8 payload[DCHU_DSM_PAYLOAD_MAX];
+    u64 idx;                   /* evaluation that produced the result */
+    int ret;
+    acpi_object_type type;
+    u64 integer;
+    u32 len;
+    u8 data[DCHU_DSM_BUF_MAX];
+};
+
+struct dchu_dsm_stat;
+struct dchu;
+
+/* Queued dchu_call_dsm_async() call; owned by the core, valid during done() */
+struct dchu_async_req {
+    struct work_struct work;
+    struct dchu *core;
+    u64 function;
+    void (*done)(const struct dchu_async_req *req, int ret);
+    void *data;                /* caller cookie */
+    u32 payload_len;
+    u8 payload[];
+};
+
+/*
+ * Firmware backend. evaluate() follows acpi_evaluate_object() semantics
+ * for output: either a caller buffer (AE_BUFFER_OVERFLOW when too small)
+ * or ACPI_ALLOCATE_BUFFER (result freed with kfree()).
+ */
+struct dchu_backend_ops {
+    const char *name;
+    acpi_status (*evaluate)(struct dchu *core, u64 function,
+                            const u8 *payload, u32 payload_len,
+                            struct acpi_buffer *output);
+};
 
 struct dchu {
     struct device *dev;        /* core parent device */
+    const struct dchu_backend_ops *ops;  /* ACPI _DSM or mock firmware */
+    void *backend_data;
     acpi_handle handle;        /* ACPI handle for _DSM calls */
     u8 uuid[16];               /* _DSM UUID */
     u64 rev;                   /* _DSM revision */
+    struct mutex lock;         /* one _DSM evaluation at a time */
+    atomic64_t seq;            /* 2 * evaluations started, odd while one runs */
+    struct dchu_dsm_slot slots[DCHU_DSM_SLOTS];
+    unsigned int next_slot;
+    struct dchu_dsm_stat *stats;  /* per-function accounting, core private */
+    struct dentry *debugfs;
+    bool smi_ok;               /* MSR_SMI_COUNT readable */
+    struct workqueue_struct *wq;  /* ordered, runs async submissions */
+    struct blocking_notifier_head notifier;  /* EC events for the children */
+    struct input_dev *input;   /* hotkeys from EC events */
+    atomic_t writers;          /* dchu_call_dsm() writes waiting for or holding lock */
+    u64 rate_tat;              /* token bucket, see dchu_rate_wait() */
+    DECLARE_BITMAP(funcs, DCHU_DSM_FUNCS);  /* _DSM 0 answer, read at probe */
+    bool funcs_known;          /* funcs is valid; otherwise assume every id */
+    u8 out[DCHU_DSM_OUT_MAX] __aligned(8);  /* _DSM result, under lock */
 };
 
 struct dchu_cell_pdata {
@@ -18,6 +171,35 @@ struct dchu_cell_pdata {
 int dchu_call_dsm(struct dchu *core, u64 function,
                   const u8 *payload, u32 payload_len,
                   union acpi_object **out_obj);
+int dchu_call_dsm_res(struct dchu *core, u64 function,
+                      const u8 *payload, u32 payload_len,
+                      struct dchu_dsm_res *res);
+int dchu_call_dsm_batch(struct dchu *core, struct dchu_dsm_req *reqs,
+                        unsigned int nr, u8 *arena, u32 arena_size);
+int dchu_call_dsm_async(struct dchu *core, u64 function,
+                        const u8 *payload, u32 payload_len,
+                        void (*done)(const struct dchu_async_req *req, int ret),
+                        void *data);
+void dchu_flush_async(struct dchu *core);
+int dchu_register_notifier(struct dchu *core, struct notifier_block *nb);
+int dchu_unregister_notifier(struct dchu *core, struct notifier_block *nb);
+int dchu_query_dsm(struct dchu *core, u64 function,
+                   const u8 *payload, u32 payload_len,
+                   struct dchu_dsm_res *res);
+bool dchu_has_func(struct dchu *core, u64 function);
+
+#if IS_ENABLED(CONFIG_KUNIT)
+/* Mock firmware core without a device or children, for dchu_kunit */
+struct dchu *dchu_mock_core_create(void);
+void dchu_mock_core_destroy(struct dchu *core);
+void dchu_mock_state(struct dchu *core, u8 *kbd_level, u8 *fan_mode);
+
+/* dchu_leds internals under test; the hwmon ones are in dchu_hwmon.h */
+struct led_classdev;
+struct led_classdev *dchu_leds_kunit_create(struct device *dev, struct dchu *core);
+void dchu_leds_kunit_flush(struct led_classdev *cdev);
+int dchu_led_resync(struct led_classdev *cdev);
+#endif
 
 #endif /* _DCHU_H */
 
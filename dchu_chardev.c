@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/platform_device.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/capability.h>
+#include "dchu.h"
+#include "dchu_uapi.h"
+
+struct dchu_chardev_ctx {
+    struct dchu *core;          /* NULL once removed, under core_sem */
+    struct rw_semaphore core_sem;
+    struct miscdevice misc;
+    struct kref ref;            /* probe + one per open file */
+    struct delayed_work sampler;
+    wait_queue_head_t wq;
+    atomic_t users;             /* open files; sampler runs while > 0 */
+    struct mutex users_lock;    /* serializes sampler start/stop with users */
+    ktime_t next;               /* due time of the next sample */
+    struct dchu_ring_hdr *hdr;  /* vmalloc_user() ring, mapped read-only */
+    struct dchu_sample *ring;
+    size_t ring_size;
+};
+
+struct dchu_chardev_file {
+    struct dchu_chardev_ctx *ctx;
+    u64 acked;                  /* head the reader consumed, see DCHU_IOC_ACK */
+};
+
+static unsigned int rate_hz = 20;
+module_param(rate_hz, uint, 0644);
+MODULE_PARM_DESC(rate_hz, "FAN package sampling rate while /dev/dchu is open (1..1000)");
+
+static unsigned int ring_entries = 1024;
+module_param(ring_entries, uint, 0444);
+MODULE_PARM_DESC(ring_entries, "Samples kept in the ring (rounded up to a power of two)");
+
+static void dchu_chardev_free(struct kref *ref)
+{
+    struct dchu_chardev_ctx *ctx = container_of(ref, struct dchu_chardev_ctx, ref);
+
+    vfree(ctx->hdr);
+    kfree(ctx);
+}
+
+static void dchu_chardev_push(struct dchu_chardev_ctx *ctx)
+{
+    struct dchu_ring_hdr *hdr = ctx->hdr;
+    struct dchu_sample *s;
+    struct dchu_dsm_res res;
+    u64 n = hdr->head;
+    int ret;
+
+    s = &ctx->ring[n & (hdr->nr_entries - 1)];
+    WRITE_ONCE(s->seq, ~0ULL);
+    smp_wmb();
+
+    /* Decode straight into the slot; shared with concurrent hwmon reads */
+    res = (struct dchu_dsm_res){ .buf = s->raw, .size = sizeof(s->raw) };
+    down_read(&ctx->core_sem);
+    ret = ctx->core ? dchu_query_dsm(ctx->core, 12 /* FAN package */, NULL, 0, &res)
+                    : -ENODEV;
+    up_read(&ctx->core_sem);
+    if (!ret && res.type != ACPI_TYPE_BUFFER)
+        ret = -EIO;
+
+    s->time_ns = ktime_get_ns();
+    s->status = ret;
+    s->len = ret ? 0 : min_t(u32, res.len, sizeof(s->raw));
+    memset(s->raw + s->len, 0, sizeof(s->raw) - s->len);
+
+    smp_wmb();
+    WRITE_ONCE(s->seq, n);
+    smp_store_release(&hdr->head, n + 1);
+    wake_up_interruptible(&ctx->wq);
+}
+
+static void dchu_chardev_sample(struct work_struct *work)
+{
+    struct dchu_chardev_ctx *ctx = container_of(to_delayed_work(work),
+                                                struct dchu_chardev_ctx, sampler);
+    u64 period = NSEC_PER_SEC / clamp(rate_hz, 1U, 1000U);
+    ktime_t now;
+
+    if (!atomic_read(&ctx->users))
+        return;
+
+    WRITE_ONCE(ctx->hdr->period_us, (u32)div_u64(period, NSEC_PER_USEC));
+    dchu_chardev_push(ctx);
+
+    /* Keep a fixed cadence; skip ahead instead of bursting if we fell behind */
+    now = ktime_get();
+    ctx->next = ktime_add_ns(ctx->next, period);
+    if (ktime_before(ctx->next, now))
+        ctx->next = now;
+    queue_delayed_work(system_unbound_wq, &ctx->sampler,
+                       nsecs_to_jiffies(ktime_to_ns(ktime_sub(ctx->next, now))));
+}
+
+static int dchu_chardev_open(struct inode *inode, struct file *file)
+{
+    struct dchu_chardev_ctx *ctx = container_of(file->private_data,
+                                                struct dchu_chardev_ctx, misc);
+    struct dchu_chardev_file *f;
+
+    if (file->f_mode & FMODE_WRITE)
+        return -EPERM;
+
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f)
+        return -ENOMEM;
+    kref_get(&ctx->ref);
+    f->ctx = ctx;
+    f->acked = smp_load_acquire(&ctx->hdr->head);
+    file->private_data = f;
+
+    /* Under users_lock so a racing last close cannot cancel this start */
+    mutex_lock(&ctx->users_lock);
+    if (atomic_inc_return(&ctx->users) == 1 && READ_ONCE(ctx->core)) {
+        ctx->next = ktime_get();
+        queue_delayed_work(system_unbound_wq, &ctx->sampler, 0);
+    }
+    mutex_unlock(&ctx->users_lock);
+    return 0;
+}
+
+static int dchu_chardev_release(struct inode *inode, struct file *file)
+{
+    struct dchu_chardev_file *f = file->private_data;
+    struct dchu_chardev_ctx *ctx = f->ctx;
+
+    mutex_lock(&ctx->users_lock);
+    if (atomic_dec_and_test(&ctx->users))
+        cancel_delayed_work_sync(&ctx->sampler);
+    mutex_unlock(&ctx->users_lock);
+    kfree(f);
+    kref_put(&ctx->ref, dchu_chardev_free);
+    return 0;
+}
+
+/* Readable while samples past the reader's last ack exist; no side effects */
+static __poll_t dchu_chardev_poll(struct file *file, poll_table *wait)
+{
+    struct dchu_chardev_file *f = file->private_data;
+    struct dchu_chardev_ctx *ctx = f->ctx;
+    __poll_t mask = 0;
+
+    poll_wait(file, &ctx->wq, wait);
+    if (smp_load_acquire(&ctx->hdr->head) != READ_ONCE(f->acked))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (!READ_ONCE(ctx->core))
+        mask |= EPOLLHUP | EPOLLERR;
+    return mask;
+}
+
+/* The reader has consumed every sample below *uhead */
+static long dchu_chardev_ack(struct dchu_chardev_file *f, u64 __user *uhead)
+{
+    u64 head, val;
+
+    if (get_user(val, uhead))
+        return -EFAULT;
+    head = smp_load_acquire(&f->ctx->hdr->head);
+    if (val > head)
+        return -EINVAL;
+    WRITE_ONCE(f->acked, val);
+    return 0;
+}
+
+static int dchu_chardev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct dchu_chardev_file *f = file->private_data;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > f->ctx->ring_size)
+        return -EINVAL;
+    vm_flags_clear(vma, VM_MAYWRITE);
+    return remap_vmalloc_range(vma, f->ctx->hdr, 0);
+}
+
+/* One chunk of a raw batch through the core batch API, results in place */
+static void dchu_chardev_raw_chunk(struct dchu *core, struct dchu_dsm_req *reqs,
+                                   struct dchu_raw_call *calls, unsigned int n)
+{
+    struct dchu_raw_call *c;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        c = &calls[i];
+        reqs[i] = (struct dchu_dsm_req){
+            .function = c->function,
+            .payload = c->payload,
+            .payload_len = c->payload_len,
+            .res = { .buf = c->buf, .size = sizeof(c->buf) },
+            .ret = -ENODEV,     /* kept if the core refuses the chunk */
+        };
+    }
+    /* Per-entry status below; the return value is only the first of them */
+    dchu_call_dsm_batch(core, reqs, n, NULL, 0);
+    for (i = 0; i < n; i++) {
+        c = &calls[i];
+        c->status = reqs[i].ret;
+        c->type = c->status ? 0 : reqs[i].res.type;
+        c->integer = c->status ? 0 : reqs[i].res.integer;
+        c->len = c->status ? 0 : reqs[i].res.len;
+        c->reserved = 0;
+        c->duration_ns = reqs[i].duration_ns;
+    }
+}
+
+static long dchu_chardev_raw_batch(struct dchu_chardev_ctx *ctx,
+                                   struct dchu_raw_batch __user *ubatch)
+{
+    struct dchu_raw_batch batch;
+    struct dchu_raw_call *calls;
+    struct dchu_dsm_req *reqs;
+    unsigned int i, n;
+    size_t size;
+    long ret = 0;
+
+    if (!capable(CAP_SYS_RAWIO))
+        return -EPERM;
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    if (!batch.nr || batch.nr > DCHU_RAW_BATCH_MAX || batch.flags)
+        return -EINVAL;
+
+    size = array_size(batch.nr, sizeof(*calls));
+    calls = vmemdup_user(u64_to_user_ptr(batch.calls), size);
+    if (IS_ERR(calls))
+        return PTR_ERR(calls);
+    for (i = 0; i < batch.nr; i++) {
+        if (calls[i].flags || calls[i].payload_len > DCHU_RAW_PAYLOAD_MAX) {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+    reqs = kcalloc(DCHU_DSM_BATCH_MAX, sizeof(*reqs), GFP_KERNEL);
+    if (!reqs) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    down_read(&ctx->core_sem);
+    if (!ctx->core)
+        ret = -ENODEV;
+    for (i = 0; !ret && i < batch.nr; i += n) {
+        n = min_t(unsigned int, batch.nr - i, DCHU_DSM_BATCH_MAX);
+        dchu_chardev_raw_chunk(ctx->core, reqs, calls + i, n);
+    }
+    up_read(&ctx->core_sem);
+    kfree(reqs);
+
+    if (!ret && copy_to_user(u64_to_user_ptr(batch.calls), calls, size))
+        ret = -EFAULT;
+out:
+    kvfree(calls);
+    return ret;
+}
+
+static long dchu_chardev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct dchu_chardev_file *f = file->private_data;
+
+    switch (cmd) {
+    case DCHU_IOC_RAW_BATCH:
+        return dchu_chardev_raw_batch(f->ctx, (void __user *)arg);
+    case DCHU_IOC_ACK:
+        return dchu_chardev_ack(f, (u64 __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+static const struct file_operations dchu_chardev_fops = {
+    .owner = THIS_MODULE,
+    .open = dchu_chardev_open,
+    .release = dchu_chardev_release,
+    .poll = dchu_chardev_poll,
+    .mmap = dchu_chardev_mmap,
+    .unlocked_ioctl = dchu_chardev_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = noop_llseek,
+};
+
+static int dchu_chardev_probe(struct platform_device *pdev)
+{
+    struct dchu_cell_pdata *pdata = dev_get_platdata(&pdev->dev);
+    struct dchu_chardev_ctx *ctx;
+    u32 nr, off;
+    int ret;
+
+    if (!pdata || !pdata->core)
+        return -ENODEV;
+
+    ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return -ENOMEM;
+    ctx->core = pdata->core;
+    init_rwsem(&ctx->core_sem);
+    mutex_init(&ctx->users_lock);
+    kref_init(&ctx->ref);
+    init_waitqueue_head(&ctx->wq);
+    INIT_DELAYED_WORK(&ctx->sampler, dchu_chardev_sample);
+
+    nr = roundup_pow_of_two(clamp(ring_entries, 16U, 65536U));
+    off = ALIGN(sizeof(struct dchu_ring_hdr), 64);
+    ctx->ring_size = PAGE_ALIGN(off + (size_t)nr * sizeof(struct dchu_sample));
+    ctx->hdr = vmalloc_user(ctx->ring_size);
+    if (!ctx->hdr) {
+        kfree(ctx);
+        return -ENOMEM;
+    }
+    ctx->hdr->magic = DCHU_RING_MAGIC;
+    ctx->hdr->version = DCHU_RING_VERSION;
+    ctx->hdr->entry_size = sizeof(struct dchu_sample);
+    ctx->hdr->nr_entries = nr;
+    ctx->hdr->data_offset = off;
+    ctx->ring = (void *)ctx->hdr + off;
+
+    ctx->misc.minor = MISC_DYNAMIC_MINOR;
+    ctx->misc.name = "dchu";
+    ctx->misc.fops = &dchu_chardev_fops;
+    ctx->misc.mode = 0444;
+    ctx->misc.parent = &pdev->dev;
+
+    ret = misc_register(&ctx->misc);
+    if (ret) {
+        kref_put(&ctx->ref, dchu_chardev_free);
+        return ret;
+    }
+
+    platform_set_drvdata(pdev, ctx);
+    dev_info(&pdev->dev, "dchu-chardev initialized (%u samples)\n", nr);
+    return 0;
+}
+
+static void dchu_chardev_remove(struct platform_device *pdev)
+{
+    struct dchu_chardev_ctx *ctx = platform_get_drvdata(pdev);
+
+    /* Open files keep ctx and the ring alive until their last close */
+    misc_deregister(&ctx->misc);
+    down_write(&ctx->core_sem);
+    ctx->core = NULL;
+    up_write(&ctx->core_sem);
+    /* Pollers see EPOLLHUP from now on */
+    wake_up_interruptible(&ctx->wq);
+    /* Files still open must not keep sampling a core that is going away */
+    mutex_lock(&ctx->users_lock);
+    cancel_delayed_work_sync(&ctx->sampler);
+    mutex_unlock(&ctx->users_lock);
+    kref_put(&ctx->ref, dchu_chardev_free);
+}
+
+static struct platform_driver dchu_chardev_driver = {
+    .driver = {
+        .name = "dchu-chardev",
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+    },
+    .probe = dchu_chardev_probe,
+    .remove = dchu_chardev_remove,
+};
+
+module_platform_driver(dchu_chardev_driver);
+
+MODULE_ALIAS("platform:dchu-chardev");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Insyde DCHU telemetry character device");
+MODULE_AUTHOR("stdpi <iam@stdpi.work>");
@@ -6,28 +6,166 @@
 #include <linux/platform_device.h>
 #include <linux/slab.h>
 #include <linux/mfd/core.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/version.h>
+#include <linux/delay.h>
+#include <linux/uaccess.h>
+#include <linux/input.h>
+#include <linux/input/sparse-keymap.h>
+#include <kunit/visibility.h>
+#ifdef CONFIG_X86
+#include <asm/msr.h>
+#endif
 #include "dchu.h"
 
+#define CREATE_TRACE_POINTS
+#include "dchu_trace.h"
+
+/* One entry per function id covered by the _DSM 0 bitmap, plus "other" */
+#define DCHU_STAT_FNS      (DCHU_DSM_FUNCS + 1)
+#define DCHU_STAT_BUCKETS  32   /* log2(ns) latency buckets, last one open-ended */
+
+/* Per function id _DSM accounting, updated under core->lock */
+struct dchu_dsm_stat {
+    bool used;
+    u64 function;
+    u64 calls;
+    u64 errors;
+    u64 total_ns;
+    u64 max_ns;
+    u64 smi;                      /* MSR_SMI_COUNT delta summed over calls */
+    u64 throttled;                /* queries answered stale or delayed by rate_limit */
+    u64 hist[DCHU_STAT_BUCKETS];  /* hist[i]: 2^i <= ns < 2^(i+1) */
+};
+
+#if defined(CONFIG_X86) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+#define rdmsrq_safe rdmsrl_safe
+#endif
+
 static const u8 dchu_uuid_def[16] = {
     0xE4,0x24,0xF2,0x93, 0xDC,0xFB, 0xBF,0x4B,
     0xAD,0xD6,0xDB,0x71, 0xBD,0xC0,0xAF,0xAD
 };
 
-static struct platform_device *dchu_parent;
-static struct dchu *dchu_core;
+/* Software "dchu" device the driver binds when mock=1 */
+static struct platform_device *dchu_mock_pdev;
 
-int dchu_call_dsm(struct dchu *core, u64 function,
-                  const u8 *payload, u32 payload_len,
-                  union acpi_object **out_obj)
+static bool mock;
+module_param(mock, bool, 0444);
+MODULE_PARM_DESC(mock, "Use the in-kernel mock firmware instead of ACPI CLV0001");
+
+static bool dsm_check = true;
+module_param(dsm_check, bool, 0644);
+MODULE_PARM_DESC(dsm_check, "Fail calls to functions missing from the _DSM 0 bitmap with EOPNOTSUPP (0 = report only)");
+
+/* Firmware call budget, see dchu_rate_wait() */
+static unsigned int rate_limit;
+module_param(rate_limit, uint, 0644);
+MODULE_PARM_DESC(rate_limit, "Budget of _DSM calls per second; queries over it get stale results (0 = unlimited)");
+
+static unsigned int rate_burst = 8;
+module_param(rate_burst, uint, 0644);
+MODULE_PARM_DESC(rate_burst, "Calls allowed back to back before rate_limit applies");
+
+#define DCHU_MOCK_PKG_MAX 64
+
+/* Mock firmware state, guarded by core->lock; knobs live in debugfs */
+struct dchu_mock {
+    u8 fan_pkg[DCHU_MOCK_PKG_MAX];
+    u32 fan_len;
+    u8 kbd_level;
+    u8 fan_mode;
+    u32 latency_us;
+    u32 event;      /* code returned by _DSM 1 */
+    u8 funcs[16];   /* function 0 bitmap, bit n = function n answered */
+};
+
+/* Plausible U4 UD idle package: ~2500/2100 RPM, 40% duty, 55/60 °C */
+static const u8 dchu_mock_pkg_def[32] = {
+    [2] = 0x03, [3] = 0x5e, [4] = 0x04, [5] = 0x03,
+    [16] = 40, [18] = 55, [19] = 40, [21] = 60,
+};
+
+/* SMIs are broadcast, so the local CPU's count is good enough for a delta */
+static u64 dchu_smi_count(struct dchu *core)
+{
+#ifdef CONFIG_X86
+    u64 v;
+
+    if (core->smi_ok && !rdmsrq_safe(MSR_SMI_COUNT, &v))
+        return v;
+#endif
+    return 0;
+}
+
+/* Indexed by function id; ids past the bitmap share the last entry */
+static struct dchu_dsm_stat *dchu_stat_get(struct dchu *core, u64 function)
+{
+    struct dchu_dsm_stat *st;
+
+    if (!core->stats)
+        return NULL;
+    st = &core->stats[min_t(u64, function, DCHU_STAT_FNS - 1)];
+    st->used = true;
+    st->function = function;
+    return st;
+}
+
+static void dchu_stat_account(struct dchu *core, u64 function, int ret,
+                              u64 ns, u64 smi)
+{
+    struct dchu_dsm_stat *st = dchu_stat_get(core, function);
+
+    if (!st)
+        return;
+    st->calls++;
+    if (ret)
+        st->errors++;
+    st->total_ns += ns;
+    st->max_ns = max(st->max_ns, ns);
+    st->smi += smi;
+    st->hist[ns ? min_t(int, ilog2(ns), DCHU_STAT_BUCKETS - 1) : 0]++;
+}
+
+static int dchu_stats_show(struct seq_file *m, void *unused)
+{
+    struct dchu *core = m->private;
+    struct dchu_dsm_stat *st;
+    int i, b;
+
+    mutex_lock(&core->lock);
+    for (i = 0; i < DCHU_STAT_FNS; i++) {
+        st = &core->stats[i];
+        if (!st->used)
+            continue;
+        if (i == DCHU_STAT_FNS - 1)
+            seq_puts(m, "function=other");
+        else
+            seq_printf(m, "function=%llu", st->function);
+        seq_printf(m, " calls=%llu errors=%llu total_ns=%llu max_ns=%llu smi=%llu throttled=%llu hist_log2_ns=",
+                   st->calls, st->errors, st->total_ns,
+                   st->max_ns, st->smi, st->throttled);
+        for (b = 0; b < DCHU_STAT_BUCKETS; b++)
+            if (st->hist[b])
+                seq_printf(m, "%d:%llu,", b, st->hist[b]);
+        seq_putc(m, '\n');
+    }
+    mutex_unlock(&core->lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(dchu_stats);
+
+/* Default backend: the CLV0001 _DSM method */
+static acpi_status dchu_acpi_evaluate(struct dchu *core, u64 function,
+                                      const u8 *payload, u32 payload_len,
+                                      struct acpi_buffer *output)
 {
     union acpi_object args[4];
     struct acpi_object_list input;
-    struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
-    acpi_status status;
-    union acpi_object *obj;
-
-    if (!core || !core->handle)
-        return -ENODEV;
+    union acpi_object elem;
 
     args[0].type = ACPI_TYPE_BUFFER;
     args[0].buffer.length = sizeof(core->uuid);
@@ -39,82 +177,858 @@ int dchu_call_dsm(struct dchu *core, u64 function,
     args[2].type = ACPI_TYPE_INTEGER;
     args[2].integer.value = function;
 
+    args[3].type = ACPI_TYPE_PACKAGE;
     if (payload && payload_len) {
-        union acpi_object elem;
         elem.type = ACPI_TYPE_BUFFER;
         elem.buffer.length = payload_len;
         elem.buffer.pointer = (u8 *)payload;
-        args[3].type = ACPI_TYPE_PACKAGE;
         args[3].package.count = 1;
         args[3].package.elements = &elem;
-        input.count = 4;
-        input.pointer = args;
-        status = acpi_evaluate_object(core->handle, "_DSM", &input, &output);
     } else {
-        args[3].type = ACPI_TYPE_PACKAGE;
         args[3].package.count = 0;
         args[3].package.elements = NULL;
-        input.count = 4;
-        input.pointer = args;
-        status = acpi_evaluate_object(core->handle, "_DSM", &input, &output);
     }
+    input.count = 4;
+    input.pointer = args;
+    return acpi_evaluate_object(core->handle, "_DSM", &input, output);
+}
 
-    if (ACPI_FAILURE(status))
-        return -EIO;
+static const struct dchu_backend_ops dchu_acpi_ops = {
+    .name = "acpi",
+    .evaluate = dchu_acpi_evaluate,
+};
 
-    obj = output.pointer;
-    if (!obj)
-        return -EIO;
+static acpi_status dchu_mock_put(struct acpi_buffer *output, acpi_object_type type,
+                                 u64 integer, const u8 *data, u32 len)
+{
+    acpi_size need = sizeof(union acpi_object) + len;
+    union acpi_object *obj;
 
-    if (out_obj) {
-        *out_obj = obj; /* caller must kfree() */
-        return 0;
+    if (output->length == ACPI_ALLOCATE_BUFFER) {
+        obj = kzalloc(need, GFP_KERNEL);
+        if (!obj)
+            return AE_NO_MEMORY;
+        output->pointer = obj;
+    } else if (output->length < need) {
+        output->length = need;
+        return AE_BUFFER_OVERFLOW;
+    } else {
+        obj = output->pointer;
+    }
+    output->length = need;
+
+    obj->type = type;
+    if (type == ACPI_TYPE_INTEGER) {
+        obj->integer.value = integer;
+    } else {
+        obj->buffer.length = len;
+        obj->buffer.pointer = (u8 *)(obj + 1);
+        memcpy(obj->buffer.pointer, data, len);
     }
+    return AE_OK;
+}
+
+/* Mock backend: answers the function ids the children use */
+static acpi_status dchu_mock_evaluate(struct dchu *core, u64 function,
+                                      const u8 *payload, u32 payload_len,
+                                      struct acpi_buffer *output)
+{
+    struct dchu_mock *m = core->backend_data;
+
+    if (m->latency_us)
+        usleep_range(m->latency_us, m->latency_us + m->latency_us / 8 + 1);
+
+    if (function >= 8 * sizeof(m->funcs) ||
+        !(m->funcs[function / 8] & BIT(function % 8)))
+        return AE_NOT_IMPLEMENTED;
 
-    kfree(obj);
+    switch (function) {
+    case 0:
+        return dchu_mock_put(output, ACPI_TYPE_BUFFER, 0, m->funcs,
+                             sizeof(m->funcs));
+    case 1:
+        return dchu_mock_put(output, ACPI_TYPE_INTEGER, m->event, NULL, 0);
+    case 12:
+        return dchu_mock_put(output, ACPI_TYPE_BUFFER, 0, m->fan_pkg, m->fan_len);
+    case 39:
+        if (payload_len)
+            m->kbd_level = payload[0];
+        break;
+    case 61:
+        return dchu_mock_put(output, ACPI_TYPE_INTEGER, m->kbd_level, NULL, 0);
+    case 104:
+        /* Duty 0..255 per fan, reported back as 0..100 in the package */
+        if (payload_len >= 3) {
+            m->fan_pkg[16] = DIV_ROUND_CLOSEST(payload[0] * 100, 255);
+            m->fan_pkg[19] = DIV_ROUND_CLOSEST(payload[1] * 100, 255);
+            m->fan_pkg[22] = DIV_ROUND_CLOSEST(payload[2] * 100, 255);
+        }
+        break;
+    case 121:
+        if (payload_len >= 4 && payload[3] == 1)
+            m->fan_mode = payload[0];
+        break;
+    }
+    return dchu_mock_put(output, ACPI_TYPE_INTEGER, 0, NULL, 0);
+}
+
+static const struct dchu_backend_ops dchu_mock_ops = {
+    .name = "mock",
+    .evaluate = dchu_mock_evaluate,
+};
+
+static ssize_t dchu_mock_pkg_read(struct file *file, char __user *ubuf,
+                                  size_t count, loff_t *ppos)
+{
+    struct dchu *core = file->private_data;
+    struct dchu_mock *m = core->backend_data;
+    char buf[DCHU_MOCK_PKG_MAX * 3 + 1];
+    int n = 0;
+    u32 i;
+
+    mutex_lock(&core->lock);
+    for (i = 0; i < m->fan_len; i++)
+        n += scnprintf(buf + n, sizeof(buf) - n, "%02x%s", m->fan_pkg[i],
+                       i + 1 < m->fan_len ? " " : "\n");
+    mutex_unlock(&core->lock);
+    return simple_read_from_buffer(ubuf, count, ppos, buf, n);
+}
+
+/* Accepts whitespace separated hex bytes, e.g. "00 00 03 5e ..." */
+static ssize_t dchu_mock_pkg_write(struct file *file, const char __user *ubuf,
+                                   size_t count, loff_t *ppos)
+{
+    struct dchu *core = file->private_data;
+    struct dchu_mock *m = core->backend_data;
+    u8 pkg[DCHU_MOCK_PKG_MAX];
+    char *buf, *p, *tok;
+    u32 len = 0;
+    int ret = 0;
+
+    buf = memdup_user_nul(ubuf, min_t(size_t, count, DCHU_MOCK_PKG_MAX * 3 + 8));
+    if (IS_ERR(buf))
+        return PTR_ERR(buf);
+    p = buf;
+    while ((tok = strsep(&p, " \t\n")) && !ret) {
+        if (!*tok)
+            continue;
+        if (len == sizeof(pkg))
+            ret = -E2BIG;
+        else
+            ret = kstrtou8(tok, 16, &pkg[len++]);
+    }
+    kfree(buf);
+    if (ret)
+        return ret;
+
+    mutex_lock(&core->lock);
+    memcpy(m->fan_pkg, pkg, len);
+    m->fan_len = len;
+    mutex_unlock(&core->lock);
+    return count;
+}
+
+static const struct file_operations dchu_mock_pkg_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = dchu_mock_pkg_read,
+    .write = dchu_mock_pkg_write,
+    .llseek = default_llseek,
+};
+
+static struct dchu_mock *dchu_mock_create(void)
+{
+    static const u8 fns[] = { 0, 1, 12, 31, 39, 61, 104, 121 };
+    struct dchu_mock *m;
+    int i;
+
+    m = kzalloc(sizeof(*m), GFP_KERNEL);
+    if (!m)
+        return NULL;
+    memcpy(m->fan_pkg, dchu_mock_pkg_def, sizeof(dchu_mock_pkg_def));
+    m->fan_len = sizeof(dchu_mock_pkg_def);
+    for (i = 0; i < ARRAY_SIZE(fns); i++)
+        m->funcs[fns[i] / 8] |= BIT(fns[i] % 8);
+    return m;
+}
+
+static void dchu_handle_event(struct dchu *core, u32 value);
+
+/* Mock: writing a code raises it as if the EC had notified 0x80 */
+static int dchu_mock_event_set(void *data, u64 val)
+{
+    struct dchu *core = data;
+    struct dchu_mock *m = core->backend_data;
+
+    mutex_lock(&core->lock);
+    m->event = val & 0xff;
+    mutex_unlock(&core->lock);
+    dchu_handle_event(core, DCHU_EVENT_NOTIFY);
     return 0;
 }
+DEFINE_DEBUGFS_ATTRIBUTE(dchu_mock_event_fops, NULL, dchu_mock_event_set, "0x%02llx\n");
+
+static void dchu_mock_debugfs(struct dchu *core)
+{
+    struct dchu_mock *m = core->backend_data;
+    struct dentry *dir = debugfs_create_dir("mock", core->debugfs);
+
+    debugfs_create_file("fan_pkg", 0600, dir, core, &dchu_mock_pkg_fops);
+    debugfs_create_u8("kbd_level", 0600, dir, &m->kbd_level);
+    debugfs_create_u8("fan_mode", 0400, dir, &m->fan_mode);
+    debugfs_create_u32("latency_us", 0600, dir, &m->latency_us);
+    debugfs_create_file_unsafe("event", 0200, dir, core, &dchu_mock_event_fops);
+}
+
+
+/*
+ * Token bucket kept as a theoretical arrival time: every evaluation
+ * pushes rate_tat one period (1s / rate_limit) into the future, and a
+ * query may run while rate_tat is at most rate_burst periods ahead.
+ * Control calls are always charged but never held back. Returns the ns
+ * a query has to wait, 0 if it may run now; caller holds core->lock.
+ */
+static u64 dchu_rate_wait(struct dchu *core)
+{
+    unsigned int rate = READ_ONCE(rate_limit);
+    u64 now, period, ahead, allowed;
+
+    if (!rate)
+        return 0;
+    now = ktime_get_ns();
+    period = NSEC_PER_SEC / rate;
+    ahead = max(core->rate_tat, now) + period - now;
+    allowed = (u64)max(READ_ONCE(rate_burst), 1U) * period;
+    return ahead > allowed ? ahead - allowed : 0;
+}
+
+static void dchu_rate_charge(struct dchu *core)
+{
+    unsigned int rate = READ_ONCE(rate_limit);
+
+    if (rate)
+        core->rate_tat = max(core->rate_tat, ktime_get_ns()) + NSEC_PER_SEC / rate;
+}
+
+/*
+ * Evaluate _DSM once into output, which is either core->out or
+ * ACPI_ALLOCATE_BUFFER; caller holds core->lock. -EOVERFLOW means the
+ * method ran but its result did not fit.
+ */
+static int dchu_eval_locked(struct dchu *core, u64 function,
+                            const u8 *payload, u32 payload_len,
+                            struct acpi_buffer *output)
+{
+    acpi_status status;
+    u64 t0, ns, smi;
+    int ret;
+
+    /* The firmware said it cannot answer; skip the round trip */
+    if (!dchu_has_func(core, function))
+        return -EOPNOTSUPP;
+
+    dchu_rate_charge(core);
+
+    /* Evaluation in flight; the sequence is odd */
+    atomic64_inc(&core->seq);
+    trace_dchu_dsm_enter(function, payload_len);
+    smi = dchu_smi_count(core);
+    t0 = ktime_get_ns();
+
+    /* A caller buffer must not show the previous call's object on no result */
+    if (output->length != ACPI_ALLOCATE_BUFFER && output->pointer &&
+        output->length >= sizeof(union acpi_object))
+        memset(output->pointer, 0, sizeof(union acpi_object));
+
+    status = core->ops->evaluate(core, function, payload, payload_len, output);
+
+    ns = ktime_get_ns() - t0;
+    smi = dchu_smi_count(core) - smi;
+    /* Evaluation done; the sequence is even again */
+    atomic64_inc(&core->seq);
+
+    if (status == AE_BUFFER_OVERFLOW)
+        ret = -EOVERFLOW;
+    /* No return object: ACPICA leaves length 0, not a NULL pointer */
+    else if (ACPI_FAILURE(status) || !output->pointer ||
+             output->length < sizeof(union acpi_object))
+        ret = -EIO;
+    else
+        ret = 0;
+
+    dchu_stat_account(core, function, ret, ns, smi);
+    trace_dchu_dsm_exit(function, payload_len, ret, ns, smi);
+    return ret;
+}
+
+static void dchu_res_fill(struct dchu_dsm_res *res, acpi_object_type type,
+                          u64 integer, const u8 *data, u32 len, u32 avail)
+{
+    res->type = type;
+    res->integer = integer;
+    res->len = len;
+    if (type == ACPI_TYPE_BUFFER && res->buf)
+        memcpy(res->buf, data, min3(res->size, len, avail));
+}
+
+static void dchu_res_from_obj(struct dchu_dsm_res *res, const union acpi_object *obj)
+{
+    switch (obj->type) {
+    case ACPI_TYPE_INTEGER:
+        dchu_res_fill(res, obj->type, obj->integer.value, NULL, 0, 0);
+        break;
+    case ACPI_TYPE_BUFFER:
+        dchu_res_fill(res, obj->type, 0, obj->buffer.pointer,
+                      obj->buffer.length, obj->buffer.length);
+        break;
+    case ACPI_TYPE_PACKAGE:
+        dchu_res_fill(res, obj->type, 0, NULL, obj->package.count, 0);
+        break;
+    default:
+        dchu_res_fill(res, obj->type, 0, NULL, 0, 0);
+    }
+}
+
+/*
+ * Plain _DSM call. Serialized against every other evaluation on the
+ * device; use for commands with side effects, which makes shared
+ * queries yield to it under rate_limit. Without out_obj the
+ * result lands in the preallocated core->out buffer and is dropped, so
+ * the call does not allocate.
+ */
+int dchu_call_dsm(struct dchu *core, u64 function,
+                  const u8 *payload, u32 payload_len,
+                  union acpi_object **out_obj)
+{
+    struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+    int ret;
+
+    if (!core || !core->ops)
+        return -ENODEV;
+
+    atomic_inc(&core->writers);
+    mutex_lock(&core->lock);
+    if (!out_obj) {
+        output.length = sizeof(core->out);
+        output.pointer = core->out;
+    }
+    ret = dchu_eval_locked(core, function, payload, payload_len, &output);
+    mutex_unlock(&core->lock);
+    atomic_dec(&core->writers);
+
+    if (!out_obj)
+        return ret == -EOVERFLOW ? 0 : ret;  /* ran; result unwanted */
+    if (!ret)
+        *out_obj = output.pointer; /* caller must kfree() */
+    return ret;
+}
 EXPORT_SYMBOL_GPL(dchu_call_dsm);
 
-static int __init dchu_core_init(void)
+/*
+ * Like dchu_call_dsm() but decodes the result straight from the
+ * preallocated buffer into res. Results larger than core->out fail with
+ * -EOVERFLOW (the method still ran).
+ */
+int dchu_call_dsm_res(struct dchu *core, u64 function,
+                      const u8 *payload, u32 payload_len,
+                      struct dchu_dsm_res *res)
+{
+    struct acpi_buffer output;
+    int ret;
+
+    if (!core || !core->ops)
+        return -ENODEV;
+
+    mutex_lock(&core->lock);
+    output.length = sizeof(core->out);
+    output.pointer = core->out;
+    ret = dchu_eval_locked(core, function, payload, payload_len, &output);
+    if (!ret)
+        dchu_res_from_obj(res, output.pointer);
+    mutex_unlock(&core->lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(dchu_call_dsm_res);
+
+/*
+ * Evaluate nr requests back to back under a single hold of core->lock,
+ * each decoded from the preallocated buffer, so a sampler tick can
+ * collect several functions without interleaving or allocating.
+ * Buffer results of requests without their own res.buf are copied into
+ * consecutive 8-byte aligned slices of arena (truncated once it runs
+ * out; res.len still tells the full size). Every request gets its own
+ * ret; the return value is the first failure, or 0.
+ */
+int dchu_call_dsm_batch(struct dchu *core, struct dchu_dsm_req *reqs,
+                        unsigned int nr, u8 *arena, u32 arena_size)
 {
-    struct acpi_device *adev;
+    struct dchu_dsm_req *req;
+    struct acpi_buffer output;
+    union acpi_object *obj;
+    u32 used = 0;
+    unsigned int i;
+    int first = 0;
+    u64 t0;
+
+    if (!core || !core->ops)
+        return -ENODEV;
+    if (!nr || nr > DCHU_DSM_BATCH_MAX)
+        return -E2BIG;
+    for (i = 0; i < nr; i++)
+        if (reqs[i].payload_len && !reqs[i].payload)
+            return -EINVAL;
+
+    mutex_lock(&core->lock);
+    for (i = 0; i < nr; i++) {
+        req = &reqs[i];
+        output.length = sizeof(core->out);
+        output.pointer = core->out;
+        t0 = ktime_get_ns();
+        req->ret = dchu_eval_locked(core, req->function, req->payload,
+                                    req->payload_len, &output);
+        req->duration_ns = ktime_get_ns() - t0;
+        if (req->ret) {
+            if (!first)
+                first = req->ret;
+            continue;
+        }
+
+        obj = output.pointer;
+        if (obj->type == ACPI_TYPE_BUFFER && !req->res.buf && arena) {
+            used = min(ALIGN(used, 8), arena_size);
+            req->res.buf = arena + used;
+            req->res.size = min(obj->buffer.length, arena_size - used);
+            used += req->res.size;
+        }
+        dchu_res_from_obj(&req->res, obj);
+    }
+    mutex_unlock(&core->lock);
+    return first;
+}
+EXPORT_SYMBOL_GPL(dchu_call_dsm_batch);
+
+static void dchu_async_work(struct work_struct *work)
+{
+    struct dchu_async_req *req = container_of(work, struct dchu_async_req, work);
     int ret;
 
-    /* Require ACPI HID CLV0001 */
-    adev = acpi_dev_get_first_match_dev("CLV0001", NULL, -1);
-    if (!adev) {
-        pr_info("dchu-core: ACPI HID CLV0001 not present\n");
+    ret = dchu_call_dsm(req->core, req->function, req->payload,
+                       req->payload_len, NULL);
+    if (req->done)
+        req->done(req, ret);
+    kfree(req);
+}
+
+/*
+ * Queue a plain _DSM call and return without waiting for the firmware.
+ * Calls run one at a time in submission order on core->wq; done (may be
+ * NULL) runs there afterwards with the result. May sleep. Callers must
+ * dchu_flush_async() before the memory behind done/data goes away.
+ */
+int dchu_call_dsm_async(struct dchu *core, u64 function,
+                        const u8 *payload, u32 payload_len,
+                        void (*done)(const struct dchu_async_req *req, int ret),
+                        void *data)
+{
+    struct dchu_async_req *req;
+
+    if (!core || !core->ops || !core->wq)
         return -ENODEV;
+    if (payload_len > DCHU_DSM_PAYLOAD_MAX || (payload_len && !payload))
+        return -EINVAL;
+
+    req = kmalloc(struct_size(req, payload, payload_len), GFP_KERNEL);
+    if (!req)
+        return -ENOMEM;
+    INIT_WORK(&req->work, dchu_async_work);
+    req->core = core;
+    req->function = function;
+    req->done = done;
+    req->data = data;
+    req->payload_len = payload_len;
+    if (payload_len)
+        memcpy(req->payload, payload, payload_len);
+    queue_work(core->wq, &req->work);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(dchu_call_dsm_async);
+
+/* Wait for every async call submitted so far, callbacks included */
+void dchu_flush_async(struct dchu *core)
+{
+    if (core && core->wq)
+        flush_workqueue(core->wq);
+}
+EXPORT_SYMBOL_GPL(dchu_flush_async);
+
+static struct dchu_dsm_slot *dchu_slot_get(struct dchu *core, u64 function,
+                                           const u8 *payload, u32 payload_len,
+                                           bool create)
+{
+    struct dchu_dsm_slot *slot;
+    int i;
+
+    for (i = 0; i < DCHU_DSM_SLOTS; i++) {
+        slot = &core->slots[i];
+        if (slot->used && slot->function == function &&
+            slot->payload_len == payload_len &&
+            !memcmp(slot->payload, payload, payload_len))
+            return slot;
     }
+    if (!create)
+        return NULL;
+
+    slot = &core->slots[core->next_slot++ % DCHU_DSM_SLOTS];
+    slot->used = true;
+    slot->valid = false;
+    slot->function = function;
+    slot->payload_len = payload_len;
+    memcpy(slot->payload, payload, payload_len);
+    return slot;
+}
+
+/*
+ * Side-effect free _DSM query with single-flight semantics: a caller that
+ * arrives while an identical query is being evaluated, or queued behind
+ * other evaluations, takes the result of that evaluation instead of
+ * issuing its own. Results are copied into res; no allocation is handed
+ * to the caller.
+ */
+int dchu_query_dsm(struct dchu *core, u64 function,
+                   const u8 *payload, u32 payload_len,
+                   struct dchu_dsm_res *res)
+{
+    struct dchu_dsm_slot *slot;
+    struct dchu_dsm_stat *st;
+    struct acpi_buffer output;
+    union acpi_object *obj;
+    u64 ticket, wait;
+    int ret;
+
+    if (!core || !core->ops)
+        return -ENODEV;
+    if (payload_len > DCHU_DSM_PAYLOAD_MAX || (payload_len && !payload))
+        return -EINVAL;
 
-    dchu_core = kzalloc(sizeof(*dchu_core), GFP_KERNEL);
-    if (!dchu_core) {
-        ret = -ENOMEM;
-        goto put_adev;
+    /* Any evaluation with index >= ticket was in flight or started after us */
+    ticket = (u64)atomic64_read(&core->seq) >> 1;
+
+retry:
+    mutex_lock(&core->lock);
+    slot = dchu_slot_get(core, function, payload, payload_len, true);
+    wait = slot->valid && slot->idx >= ticket ? 0 : dchu_rate_wait(core);
+    /*
+     * Over budget, or under a budget with a control call waiting: yield
+     * by reusing the last result as if it had been fresh.
+     */
+    if (slot->valid && slot->idx < ticket &&
+        (wait || (READ_ONCE(rate_limit) && atomic_read(&core->writers)))) {
+        st = dchu_stat_get(core, function);
+        if (st)
+            st->throttled++;
+        ticket = 0;
+    } else if (wait) {
+        /* Nothing to serve yet; come back when the budget allows */
+        st = dchu_stat_get(core, function);
+        if (st)
+            st->throttled++;
+        mutex_unlock(&core->lock);
+        fsleep(div_u64(wait, NSEC_PER_USEC) + 1);
+        goto retry;
+    }
+    if (!slot->valid || slot->idx < ticket) {
+        slot->idx = (u64)atomic64_read(&core->seq) >> 1;
+        output.length = sizeof(core->out);
+        output.pointer = core->out;
+        ret = dchu_eval_locked(core, function, payload, payload_len, &output);
+        if (ret == -EOVERFLOW) {
+            /* No side effects, so oversized results may simply be re-read */
+            output.length = ACPI_ALLOCATE_BUFFER;
+            output.pointer = NULL;
+            ret = dchu_eval_locked(core, function, payload, payload_len, &output);
+        }
+        obj = output.pointer;
+        slot->valid = true;  /* failures are shared with waiters too */
+        slot->ret = ret;
+        slot->type = ACPI_TYPE_ANY;
+        slot->integer = 0;
+        slot->len = 0;
+        if (!ret) {
+            slot->type = obj->type;
+            if (obj->type == ACPI_TYPE_INTEGER) {
+                slot->integer = obj->integer.value;
+            } else if (obj->type == ACPI_TYPE_BUFFER) {
+                slot->len = obj->buffer.length;
+                memcpy(slot->data, obj->buffer.pointer,
+                       min_t(u32, slot->len, sizeof(slot->data)));
+            } else if (obj->type == ACPI_TYPE_PACKAGE) {
+                slot->len = obj->package.count;
+            }
+        }
+        if (obj != (void *)core->out)
+            kfree(obj);
     }
-    dchu_core->dev = &adev->dev;
-    dchu_core->handle = adev->handle;
-    memcpy(dchu_core->uuid, dchu_uuid_def, sizeof(dchu_core->uuid));
-    dchu_core->rev = 1;
+    ret = slot->ret;
+    if (!ret)
+        dchu_res_fill(res, slot->type, slot->integer, slot->data, slot->len,
+                      sizeof(slot->data));
+    mutex_unlock(&core->lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(dchu_query_dsm);
 
-    /* Parent platform device for MFD children */
-    dchu_parent = platform_device_alloc("dchu", PLATFORM_DEVID_NONE);
-    if (!dchu_parent) {
-        ret = -ENOMEM;
-        goto free_core;
+/* Hotkeys among the EC events; everything else only goes to the children */
+static const struct key_entry dchu_keymap[] = {
+    { KE_KEY, DCHU_EVENT_TOUCHPAD, { KEY_TOUCHPAD_TOGGLE } },
+    { KE_KEY, DCHU_EVENT_TOUCHPAD_OFF, { KEY_TOUCHPAD_OFF } },
+    { KE_KEY, DCHU_EVENT_TOUCHPAD_ON, { KEY_TOUCHPAD_ON } },
+    { KE_KEY, DCHU_EVENT_RFKILL, { KEY_RFKILL } },
+    { KE_KEY, DCHU_EVENT_RFKILL2, { KEY_RFKILL } },
+    /* The EC already acted on these; dchu-leds reports the new level */
+    { KE_IGNORE, DCHU_EVENT_KBD_DOWN, },
+    { KE_IGNORE, DCHU_EVENT_KBD_UP, },
+    { KE_IGNORE, DCHU_EVENT_KBD_CYCLE, },
+    { KE_IGNORE, DCHU_EVENT_KBD_TOGGLE, },
+    { KE_IGNORE, DCHU_EVENT_KBD_DOWN2, },
+    { KE_IGNORE, DCHU_EVENT_KBD_UP2, },
+    { KE_IGNORE, DCHU_EVENT_KBD_TOGGLE2, },
+    { KE_END, 0 }
+};
+
+int dchu_register_notifier(struct dchu *core, struct notifier_block *nb)
+{
+    if (!core)
+        return -ENODEV;
+    return blocking_notifier_chain_register(&core->notifier, nb);
+}
+EXPORT_SYMBOL_GPL(dchu_register_notifier);
+
+int dchu_unregister_notifier(struct dchu *core, struct notifier_block *nb)
+{
+    if (!core)
+        return -ENODEV;
+    return blocking_notifier_chain_unregister(&core->notifier, nb);
+}
+EXPORT_SYMBOL_GPL(dchu_unregister_notifier);
+
+/* Resolve a firmware notification to an event code and fan it out; may sleep */
+static void dchu_handle_event(struct dchu *core, u32 value)
+{
+    struct dchu_dsm_res res = { 0 };
+    unsigned long code = value;
+
+    /* 0x80 only says "something happened"; _DSM 1 dequeues what */
+    if (value == DCHU_EVENT_NOTIFY &&
+        !dchu_call_dsm_res(core, 1, NULL, 0, &res) &&
+        res.type == ACPI_TYPE_INTEGER)
+        code = res.integer & 0xff;
+
+    if (core->input && !sparse_keymap_report_event(core->input, code, 1, true))
+        dev_dbg(core->dev, "unknown EC event 0x%02lx\n", code);
+    blocking_notifier_call_chain(&core->notifier, code, core);
+}
+
+/* ACPI notify handlers run from the kacpi_notify workqueue, so may sleep */
+static void dchu_acpi_notify(acpi_handle handle, u32 event, void *data)
+{
+    dchu_handle_event(data, event);
+}
+
+static int dchu_input_create(struct dchu *core)
+{
+    struct input_dev *input;
+    int ret;
+
+    input = input_allocate_device();
+    if (!input)
+        return -ENOMEM;
+    input->name = "DCHU hotkeys";
+    input->phys = "dchu/input0";
+    input->id.bustype = BUS_HOST;
+    input->dev.parent = core->dev;
+
+    ret = sparse_keymap_setup(input, dchu_keymap, NULL);
+    if (!ret)
+        ret = input_register_device(input);
+    if (ret) {
+        input_free_device(input);
+        return ret;
     }
-    ACPI_COMPANION_SET(&dchu_parent->dev, adev);
+    core->input = input;
+    return 0;
+}
+
+/*
+ * Whether the firmware implements a function id, per the _DSM 0 bitmap
+ * read at probe. Without a usable bitmap (or with dsm_check=0) every id
+ * is assumed to exist and failures surface from the call itself.
+ */
+bool dchu_has_func(struct dchu *core, u64 function)
+{
+    if (!core->funcs_known || !READ_ONCE(dsm_check))
+        return true;
+    return function < DCHU_DSM_FUNCS && test_bit(function, core->funcs);
+}
+EXPORT_SYMBOL_GPL(dchu_has_func);
 
-    ret = platform_device_add(dchu_parent);
+/* _DSM 0 once at probe: bit n of the answer set = function n implemented */
+static void dchu_discover(struct dchu *core)
+{
+    u8 map[DCHU_DSM_FUNCS / 8] = { 0 };
+    struct dchu_dsm_res res = { .buf = map, .size = sizeof(map) };
+    u32 i, len = 0;
+    int ret;
+
+    ret = dchu_call_dsm_res(core, 0, NULL, 0, &res);
+    if (!ret && res.type == ACPI_TYPE_BUFFER) {
+        len = min(res.len, res.size);
+    } else if (!ret && res.type == ACPI_TYPE_INTEGER) {
+        for (len = 0; len < sizeof(res.integer); len++)
+            map[len] = res.integer >> (8 * len);
+    }
+
+    /* Bit 0 clear claims nothing is implemented; do not believe that */
+    if (!len || !(map[0] & BIT(0))) {
+        dev_warn(core->dev, "no usable _DSM 0 bitmap (%d), assuming every function\n",
+                 ret);
+        return;
+    }
+    for (i = 0; i < len * 8; i++)
+        if (map[i / 8] & BIT(i % 8))
+            __set_bit(i, core->funcs);
+    core->funcs_known = true;
+}
+
+static ssize_t dsm_functions_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf)
+{
+    struct dchu *core = dev_get_drvdata(dev);
+
+    if (!core->funcs_known)
+        return sysfs_emit(buf, "unknown\n");
+    return sysfs_emit(buf, "%*pbl\n", DCHU_DSM_FUNCS, core->funcs);
+}
+static DEVICE_ATTR_RO(dsm_functions);
+
+/* Backend independent state; ops and backend_data are set by the caller */
+static int dchu_core_setup(struct dchu *core)
+{
+    memcpy(core->uuid, dchu_uuid_def, sizeof(core->uuid));
+    core->rev = 1;
+    mutex_init(&core->lock);
+    atomic64_set(&core->seq, 0);
+    BLOCKING_INIT_NOTIFIER_HEAD(&core->notifier);
+#ifdef CONFIG_X86
+    {
+        u64 v;
+        core->smi_ok = !rdmsrq_safe(MSR_SMI_COUNT, &v);
+    }
+#endif
+    core->stats = kvcalloc(DCHU_STAT_FNS, sizeof(*core->stats), GFP_KERNEL);
+    if (!core->stats)
+        return -ENOMEM;
+    core->wq = alloc_ordered_workqueue("dchu", 0);
+    if (!core->wq)
+        return -ENOMEM;
+    return 0;
+}
+
+static void dchu_core_free(struct dchu *core)
+{
+    if (core->wq)
+        destroy_workqueue(core->wq);
+    kvfree(core->stats);
+    kfree(core->backend_data);
+    kfree(core);
+}
+
+#if IS_ENABLED(CONFIG_KUNIT)
+struct dchu *dchu_mock_core_create(void)
+{
+    struct dchu *core;
+
+    core = kzalloc(sizeof(*core), GFP_KERNEL);
+    if (!core)
+        return NULL;
+    core->ops = &dchu_mock_ops;
+    core->backend_data = dchu_mock_create();
+    if (!core->backend_data || dchu_core_setup(core)) {
+        dchu_core_free(core);
+        return NULL;
+    }
+    dchu_discover(core);
+    return core;
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_mock_core_create);
+
+void dchu_mock_core_destroy(struct dchu *core)
+{
+    dchu_core_free(core);
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_mock_core_destroy);
+
+/* What the mock firmware was last told through _DSM 39 and 121 */
+void dchu_mock_state(struct dchu *core, u8 *kbd_level, u8 *fan_mode)
+{
+    struct dchu_mock *m = core->backend_data;
+
+    mutex_lock(&core->lock);
+    *kbd_level = m->kbd_level;
+    *fan_mode = m->fan_mode;
+    mutex_unlock(&core->lock);
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_mock_state);
+#endif
+
+static struct attribute *dchu_core_attrs[] = {
+    &dev_attr_dsm_functions.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(dchu_core);
+
+static int dchu_core_probe(struct platform_device *pdev)
+{
+    struct acpi_device *adev = ACPI_COMPANION(&pdev->dev);
+    struct dchu *core;
+    int ret;
+
+    /* mock=1 binds only the software device, otherwise only CLV0001 */
+    if (mock == !!adev)
+        return -ENODEV;
+
+    core = kzalloc(sizeof(*core), GFP_KERNEL);
+    if (!core)
+        return -ENOMEM;
+    core->dev = &pdev->dev;
+    if (adev) {
+        core->handle = adev->handle;
+        core->ops = &dchu_acpi_ops;
+    } else {
+        core->backend_data = dchu_mock_create();
+        if (!core->backend_data) {
+            ret = -ENOMEM;
+            goto free_core;
+        }
+        core->ops = &dchu_mock_ops;
+    }
+    ret = dchu_core_setup(core);
     if (ret)
-        goto put_parent;
+        goto free_core;
+    platform_set_drvdata(pdev, core);
 
-    /* Create children: dchu-hwmon and dchu-leds */
+    /* Before the children, so they can hide what the firmware lacks */
+    dchu_discover(core);
+
+    /*
+     * Create children: dchu-hwmon, dchu-leds and dchu-chardev. They share
+     * our ACPI companion but are not its primary node, so their uevents
+     * carry platform:dchu-* modaliases and udev loads their modules.
+     */
     {
-        struct dchu_cell_pdata pdata1 = { .core = dchu_core };
-        struct dchu_cell_pdata pdata2 = { .core = dchu_core };
-        struct mfd_cell cells[2] = { 0 };
+        struct dchu_cell_pdata pdata1 = { .core = core };
+        struct dchu_cell_pdata pdata2 = { .core = core };
+        struct dchu_cell_pdata pdata3 = { .core = core };
+        struct mfd_cell cells[3] = { 0 };
 
         cells[0].name = "dchu-hwmon";
         cells[0].platform_data = &pdata1;
@@ -124,39 +1038,103 @@ static int __init dchu_core_init(void)
         cells[1].platform_data = &pdata2;
         cells[1].pdata_size = sizeof(pdata2);
 
-        ret = mfd_add_devices(&dchu_parent->dev, 0, cells, ARRAY_SIZE(cells),
-                              NULL, 0, NULL);
+        cells[2].name = "dchu-chardev";
+        cells[2].platform_data = &pdata3;
+        cells[2].pdata_size = sizeof(pdata3);
+
+        ret = mfd_add_devices(&pdev->dev, 0, cells,
+                              ARRAY_SIZE(cells), NULL, 0, NULL);
         if (ret)
-            goto del_parent;
+            goto free_core;
     }
 
-    acpi_dev_put(adev);
-    pr_info("dchu-core: registered with MFD children\n");
+    /* Hotkeys are optional; EC events still reach the children without them */
+    ret = dchu_input_create(core);
+    if (ret)
+        dev_warn(&pdev->dev, "no hotkey input device: %d\n", ret);
+
+    if (adev) {
+        acpi_status status;
+
+        status = acpi_install_notify_handler(core->handle, ACPI_DEVICE_NOTIFY,
+                                             dchu_acpi_notify, core);
+        if (ACPI_FAILURE(status))
+            dev_warn(&pdev->dev, "cannot install notify handler: %s\n",
+                     acpi_format_exception(status));
+    }
+
+    /* Diagnostics only; failure to create them is not fatal */
+    core->debugfs = debugfs_create_dir("dchu", NULL);
+    debugfs_create_file("stats", 0400, core->debugfs, core, &dchu_stats_fops);
+    if (core->ops == &dchu_mock_ops)
+        dchu_mock_debugfs(core);
+
+    dev_info(&pdev->dev, "registered with MFD children (%s backend)\n",
+             core->ops->name);
     return 0;
 
-del_parent:
-    platform_device_del(dchu_parent);
-put_parent:
-    platform_device_put(dchu_parent);
-    dchu_parent = NULL;
 free_core:
-    kfree(dchu_core);
-    dchu_core = NULL;
-put_adev:
-    acpi_dev_put(adev);
+    dchu_core_free(core);
     return ret;
 }
 
-static void __exit dchu_core_exit(void)
+static void dchu_core_remove(struct platform_device *pdev)
 {
-    if (dchu_parent) {
-        mfd_remove_devices(&dchu_parent->dev);
-        platform_device_unregister(dchu_parent);
-        dchu_parent = NULL;
+    struct dchu *core = platform_get_drvdata(pdev);
+
+    /* Waits for running handlers, so no event reaches a dying child */
+    if (core->handle)
+        acpi_remove_notify_handler(core->handle, ACPI_DEVICE_NOTIFY,
+                                   dchu_acpi_notify);
+    debugfs_remove_recursive(core->debugfs);
+    core->debugfs = NULL;
+    if (core->input)
+        input_unregister_device(core->input);
+    mfd_remove_devices(&pdev->dev);
+    dchu_core_free(core);
+}
+
+static const struct acpi_device_id dchu_acpi_ids[] = {
+    { "CLV0001", 0 },
+    { }
+};
+MODULE_DEVICE_TABLE(acpi, dchu_acpi_ids);
+
+static struct platform_driver dchu_core_driver = {
+    .driver = {
+        .name = "dchu",
+        .acpi_match_table = dchu_acpi_ids,
+        .dev_groups = dchu_core_groups,
+        /* _DSM probing and child creation stay off the boot critical path */
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+    },
+    .probe = dchu_core_probe,
+    .remove = dchu_core_remove,
+};
+
+static int __init dchu_core_init(void)
+{
+    int ret;
+
+    ret = platform_driver_register(&dchu_core_driver);
+    if (ret || !mock)
+        return ret;
+
+    /* No firmware node to match; the mock gets a software device instead */
+    dchu_mock_pdev = platform_device_register_simple("dchu", PLATFORM_DEVID_NONE,
+                                                     NULL, 0);
+    if (IS_ERR(dchu_mock_pdev)) {
+        platform_driver_unregister(&dchu_core_driver);
+        return PTR_ERR(dchu_mock_pdev);
     }
-    kfree(dchu_core);
-    dchu_core = NULL;
-    pr_info("dchu-core: unloaded\n");
+    return 0;
+}
+
+static void __exit dchu_core_exit(void)
+{
+    if (!IS_ERR_OR_NULL(dchu_mock_pdev))
+        platform_device_unregister(dchu_mock_pdev);
+    platform_driver_unregister(&dchu_core_driver);
 }
 
 module_init(dchu_core_init);
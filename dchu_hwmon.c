@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/kernel.h>
 #include <linux/acpi.h>
 #include <linux/hwmon.h>
@@ -9,240 +10,1029 @@
 #include <linux/slab.h>
 #include <linux/platform_device.h>
 #include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/jiffies.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/dmi.h>
+#include <linux/pm.h>
+#include <linux/ctype.h>
+#include <linux/version.h>
+#include <linux/thermal.h>
+#include <kunit/visibility.h>
 #include "dchu.h"
+#include "dchu_hwmon.h"
+
+/* should_bind() and the RW trip flag need 6.12 */
+#if IS_ENABLED(CONFIG_THERMAL) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#define DCHU_THERMAL
+#endif
+
+#define DCHU_FAN_BUF_MAX 256
+#define DCHU_CURVE_POINTS 6
+#define DCHU_HIST_LEN    64     /* refreshes kept for the windowed averages */
+
+/* Alarm bit layout in dchu_fan_pkg.alarms, one bit per channel */
+#define DCHU_ALARM_TEMP_MAX   0
+#define DCHU_ALARM_TEMP_CRIT  (DCHU_ALARM_TEMP_MAX + DCHU_NR_TEMPS)
+#define DCHU_ALARM_FAN        (DCHU_ALARM_TEMP_CRIT + DCHU_NR_TEMPS)
+
+/* History channel layout: fans first, then temps */
+#define DCHU_HIST_FAN    0
+#define DCHU_HIST_TEMP   DCHU_NR_FANS
+#define DCHU_HIST_CHANS  (DCHU_NR_FANS + DCHU_NR_TEMPS)
+
+enum dchu_hist_kind {
+    DCHU_HIST_LOWEST,
+    DCHU_HIST_HIGHEST,
+    DCHU_HIST_AVERAGE,
+    DCHU_HIST_SMOOTHED,
+};
+
+/* One successful refresh, as kept in the history ring */
+struct dchu_hist_sample {
+    unsigned long stamp;            /* jiffies */
+    long val[DCHU_HIST_CHANS];      /* RPM / m°C */
+};
+
+/* Per channel rolling statistics since the last reset */
+struct dchu_hist {
+    bool valid;                     /* seeded by a sample since the reset */
+    long lowest;
+    long highest;
+    long ema;                       /* smoothed value * 256 */
+    unsigned long stamp;            /* jiffies of the last sample */
+    unsigned int since;             /* first ring sample after the reset */
+};
+
+/* Thermal zone of one temp channel */
+struct dchu_tz {
+    struct dchu_hwmon_ctx *ctx;
+    int channel;
+    struct thermal_zone_device *tzd;
+};
+
+/* Temperature -> duty curve of one fan, driven by the matching temp channel */
+struct dchu_curve {
+    long temp[DCHU_CURVE_POINTS];   /* m°C */
+    u8 pwm[DCHU_CURVE_POINTS];      /* 0..255 */
+    long hyst;                      /* m°C the temp must drop before duty falls */
+    unsigned int ramp;              /* max duty change in pwm units/s, 0 = none */
+};
 
 struct dchu_hwmon_ctx {
     struct dchu *core;
     struct device *hwdev;
+    const struct dchu_layout *layout;
+    u32 min_len;                /* shortest package the layout can decode */
+    struct mutex lock;          /* protects the FAN package snapshot below */
+    unsigned long stamp;        /* jiffies of last refresh */
+    bool valid;
+    u32 len;
+    u8 buf[DCHU_FAN_BUF_MAX];   /* last FAN package (_DSM 12) */
+    struct dchu_fan_pkg pkg;    /* decoded view of buf, written under seq */
+    int status;                 /* result of the refresh that produced pkg */
+    seqlock_t seq;              /* publishes pkg/status to lock-free readers */
+    struct delayed_work sampler;
+    atomic_t sampling;          /* sampler armed, pkg is kept fresh */
+    bool dying;                 /* teardown began, sampler stays parked; under lock */
+    unsigned long last_read;    /* jiffies of the last reader */
+    long temp_max[DCHU_NR_TEMPS];   /* m°C, 0 = no limit */
+    long temp_crit[DCHU_NR_TEMPS];  /* m°C, 0 = no limit */
+    long fan_min[DCHU_NR_FANS];     /* RPM, 0 = no limit */
+    bool limits;                /* any limit set; keeps the sampler running */
+    bool duty;                  /* duty_control at probe */
     u8 fan_mode; /* last set mode */
+    struct dchu_curve curve[DCHU_NR_FANS];  /* guarded by lock */
+    struct delayed_work curve_work; /* runs while fan_mode is custom */
+    u8 curve_duty[DCHU_NR_FANS];    /* duties last pushed by the engine */
+    bool curve_live;                /* curve_duty reflects the EC */
+    struct mutex mode_lock;         /* serializes fan mode and duty changes */
+    bool manual;                    /* custom mode driven by pwmN writes */
+    u8 manual_duty[DCHU_NR_FANS];   /* last pwmN written in manual mode */
+    bool detached;                  /* no new async submissions, under mode_lock */
+    int mode_err;                   /* result of the last async fan_mode store */
+    struct notifier_block nb;       /* EC events from dchu_core */
+    bool mode_set;                  /* fan_mode was written; restored on resume */
+    struct dchu_hist hist[DCHU_HIST_CHANS];             /* guarded by lock */
+    struct dchu_hist_sample hist_ring[DCHU_HIST_LEN];   /* guarded by lock */
+    unsigned int hist_head;         /* samples ever added to hist_ring */
+    struct dchu_tz tz[DCHU_NR_TEMPS];
+    struct thermal_cooling_device *cdev;    /* EC fan modes as cooling states */
+    unsigned long cool_state;       /* last state the governor asked for */
+    int cool_base;                  /* mode found when a trip first fired, -1 = none; under mode_lock */
+    u8 cool_mode;                   /* mode the governor last applied, under mode_lock */
 };
 
-/* Module parameters to handle inverse tach period vs RPM */
-static bool invert = true; /* default assume period -> RPM */
-module_param(invert, bool, 0644);
-MODULE_PARM_DESC(invert, "Interpret 16-bit value as tach period (inverse of RPM)");
+/* Parse table, see README "DCHU spec". Match UI math for the tach:
+ * 60/(5.565217e-05 * raw) * 2 => tach_hz = 2 * (1/5.565217e-05) ≈ 35940 Hz */
+static const struct dchu_layout dchu_layout_u4ud = {
+    .name = "Gigabyte U4 UD",
+    .nr_fans = 3,
+    .nr_temps = 3,
+    .rpm_off = { 2, 4, 6 },
+    .rpm_width = 2,
+    .le = true,
+    .invert = true,
+    .tach_hz = 35940,
+    .ppr = 1,
+    .duty_off = { 16, 19, 22 },
+    .duty_max = 100,
+    .temp_off = { 18, 21, 24 },
+    .fan_label = { "CPU", "GPU1", "GPU2" },
+    .temp_label = { "CPU", "GPU1", "GPU2" },
+};
+
+/* Unmatched machines fall back to the U4 UD layout */
+VISIBLE_IF_KUNIT const struct dmi_system_id dchu_layout_dmi[] = {
+    {
+        .matches = {
+            DMI_MATCH(DMI_SYS_VENDOR, "GIGABYTE"),
+            DMI_MATCH(DMI_PRODUCT_NAME, "U4 UD"),
+        },
+        .driver_data = (void *)&dchu_layout_u4ud,
+    },
+    { }
+};
+EXPORT_SYMBOL_IF_KUNIT(dchu_layout_dmi);
+
+/* Default curve: quiet below 40 °C, full duty from 90 °C */
+static const struct dchu_curve dchu_curve_def = {
+    .temp = { 40000, 50000, 60000, 70000, 80000, 90000 },
+    .pwm  = { 64, 90, 128, 170, 215, 255 },
+    .hyst = 3000,
+    .ramp = 64,
+};
+
+
+/* One _DSM 12 evaluation serves every attribute read within this window */
+static unsigned int cache_ms = 1000;
+module_param(cache_ms, uint, 0644);
+MODULE_PARM_DESC(cache_ms, "Lifetime of the cached FAN package in ms (0 = refresh on every read)");
+
+/* Optional background sampler; readers then never wait on firmware */
+static unsigned int sample_ms;
+module_param(sample_ms, uint, 0644);
+MODULE_PARM_DESC(sample_ms, "Background FAN package sampling interval in ms (0 = sample on demand)");
+
+static unsigned int idle_s = 10;
+module_param(idle_s, uint, 0644);
+MODULE_PARM_DESC(idle_s, "Park the background sampler after this many seconds without readers");
+
+static unsigned int curve_ms = 500;
+module_param(curve_ms, uint, 0644);
+MODULE_PARM_DESC(curve_ms, "Fan curve evaluation interval in ms while fan_mode is custom (min 100)");
+
+/* _DSM 104 is not verified on shipped firmware; nothing writes duties unless asked */
+static bool duty_control;
+module_param(duty_control, bool, 0444);
+MODULE_PARM_DESC(duty_control, "Allow fan duty writes (_DSM 104): pwmN, manual and curve modes (default off, unverified)");
+
+static bool async_mode;
+module_param(async_mode, bool, 0644);
+MODULE_PARM_DESC(async_mode, "fan_mode stores return before the EC is updated; errors go to fan_mode_error");
+
+static unsigned int alarm_ms = 1000;
+module_param(alarm_ms, uint, 0644);
+MODULE_PARM_DESC(alarm_ms, "Sampling interval in ms used for limit alarms when sample_ms=0");
+
+static unsigned int history_ms = 10000;
+module_param(history_ms, uint, 0644);
+MODULE_PARM_DESC(history_ms, "Window of the fanN_average/tempN_average attributes in ms (at most 64 samples)");
+
+static unsigned int smooth_ms = 2000;
+module_param(smooth_ms, uint, 0644);
+MODULE_PARM_DESC(smooth_ms, "Time constant of the fanN_smoothed EMA in ms (0 = no smoothing)");
 
-/* Match UI math: 60/(5.565217e-05 * raw) * 2 => tach_hz = 2 * (1/5.565217e-05) ≈ 35940 Hz */
-static unsigned int tach_hz = 35940;
+static unsigned int thermal_ms;
+module_param(thermal_ms, uint, 0444);
+MODULE_PARM_DESC(thermal_ms, "Thermal zone polling interval in ms (0 = no thermal zones or cooling device, the default)");
+
+/*
+ * Overrides of the model layout's tach/word handling; defaults keep the
+ * layout. invert and le take what a bool param does, plus "auto" (-1).
+ */
+static int dchu_param_set_auto_bool(const char *val, const struct kernel_param *kp)
+{
+    bool v;
+    int ret;
+
+    if (val && sysfs_streq(val, "auto")) {
+        WRITE_ONCE(*(int *)kp->arg, -1);
+        return 0;
+    }
+    /* A bare "invert" on the command line means yes, as for bool */
+    ret = kstrtobool(val ? val : "1", &v);
+    if (ret)
+        return ret;
+    WRITE_ONCE(*(int *)kp->arg, v);
+    return 0;
+}
+
+static int dchu_param_get_auto_bool(char *buffer, const struct kernel_param *kp)
+{
+    int v = READ_ONCE(*(int *)kp->arg);
+
+    return scnprintf(buffer, PAGE_SIZE, "%s\n", v < 0 ? "auto" : v ? "Y" : "N");
+}
+
+static const struct kernel_param_ops dchu_param_ops_auto_bool = {
+    .flags = KERNEL_PARAM_OPS_FL_NOARG,
+    .set = dchu_param_set_auto_bool,
+    .get = dchu_param_get_auto_bool,
+};
+
+static int invert = -1;
+module_param_cb(invert, &dchu_param_ops_auto_bool, &invert, 0644);
+MODULE_PARM_DESC(invert, "Interpret 16-bit value as tach period (inverse of RPM) (y/n, auto = model layout)");
+
+static unsigned int tach_hz;
 module_param(tach_hz, uint, 0644);
-MODULE_PARM_DESC(tach_hz, "EC tach base clock in Hz (used when invert=1)");
+MODULE_PARM_DESC(tach_hz, "EC tach base clock in Hz (used when inverted, 0 = model layout)");
 
-static unsigned int ppr = 1; /* pulses per revolution to mirror UI's extra *2 */
+static unsigned int ppr;
 module_param(ppr, uint, 0644);
-MODULE_PARM_DESC(ppr, "Fan pulses per revolution (used when invert=1)");
+MODULE_PARM_DESC(ppr, "Fan pulses per revolution (used when inverted, 0 = model layout)");
 
-/* Endianness of the 16-bit raw value at offsets (2,3), (4,5), (6,7) */
-static bool le = true; /* default little-endian: (hi<<8)|lo with hi at index */
-module_param(le, bool, 0644);
-MODULE_PARM_DESC(le, "Raw 16-bit word endianness (little-endian if true)");
+static int le = -1;
+module_param_cb(le, &dchu_param_ops_auto_bool, &le, 0644);
+MODULE_PARM_DESC(le, "Raw 16-bit word endianness (little-endian if true, auto = model layout)");
 
-static inline u16 dchu_get16(const u8 *b, int hi)
+/* Bytes needed to decode every channel the layout lists */
+static u32 dchu_layout_min_len(const struct dchu_layout *l)
 {
-    /* bytes at [hi] (MSB) and [hi+1] (LSB) in the parse table */
-    return le ? (u16)(((u16)b[hi] << 8) | b[hi + 1])
-              : (u16)(((u16)b[hi + 1] << 8) | b[hi]);
+    u32 len = 0;
+    int i;
+
+    for (i = 0; i < l->nr_fans; i++) {
+        len = max_t(u32, len, l->rpm_off[i] + l->rpm_width);
+        len = max_t(u32, len, l->duty_off[i] + 1);
+    }
+    for (i = 0; i < l->nr_temps; i++)
+        len = max_t(u32, len, l->temp_off[i] + 1);
+    return len;
 }
 
-static inline long dchu_to_rpm(u16 raw)
+/* Helper: call _DSM and return buffer for given function id */
+static int dchu_get_dsm_buf(struct dchu *core, u64 function, u8 *buf, u32 size,
+                            u32 min_len, u32 *len)
 {
-    if (!invert)
-        return (long)raw;
-    if (!raw || !tach_hz || !ppr)
+    struct dchu_dsm_res res = { .buf = buf, .size = size };
+    int ret;
+
+    /* Shared with any identical query already queued in the core */
+    ret = dchu_query_dsm(core, function, NULL, 0, &res);
+    if (ret)
+        return ret;
+
+    if (res.type != ACPI_TYPE_BUFFER || res.len < min_len)
+        return -EIO;
+
+    *len = min(res.len, size);
+    return 0;
+}
+
+/* One pass over the package, o overriding the layout */
+VISIBLE_IF_KUNIT void dchu_decode_with(const struct dchu_layout *l,
+                                       const struct dchu_decode_opts *o,
+                                       const u8 *b, struct dchu_fan_pkg *pkg)
+{
+    bool inv = o->invert < 0 ? l->invert : o->invert;
+    bool word_le = o->le < 0 ? l->le : o->le;
+    u32 hz = o->tach_hz ? o->tach_hz : l->tach_hz;
+    u32 pp = o->ppr ? o->ppr : l->ppr;
+    u16 raw;
+    int i;
+
+    memset(pkg, 0, sizeof(*pkg));
+    for (i = 0; i < l->nr_fans; i++) {
+        raw = l->rpm_width == 2 ? dchu_get16(b, l->rpm_off[i], word_le)
+                                : b[l->rpm_off[i]];
+        pkg->rpm[i] = dchu_to_rpm(raw, inv, hz, pp);
+        /* expose duty as pwmX (0..255) */
+        pkg->pwm[i] = min_t(long, DIV_ROUND_CLOSEST(b[l->duty_off[i]] * 255,
+                                                    l->duty_max), 255);
+    }
+    /* temps in degrees C; expose in millidegrees.
+     * NOTE: Original uses CalCPUTemp(TDP, b[18]); here we expose raw */
+    for (i = 0; i < l->nr_temps; i++)
+        pkg->temp[i] = (long)b[l->temp_off[i]] * 1000L;
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_decode_with);
+
+/* With the module params as overrides */
+static void dchu_decode(const struct dchu_layout *l, const u8 *b,
+                        struct dchu_fan_pkg *pkg)
+{
+    const struct dchu_decode_opts o = {
+        .invert = READ_ONCE(invert),
+        .le = READ_ONCE(le),
+        .tach_hz = READ_ONCE(tach_hz),
+        .ppr = READ_ONCE(ppr),
+    };
+
+    dchu_decode_with(l, &o, b, pkg);
+}
+
+static u32 dchu_eval_alarms(struct dchu_hwmon_ctx *ctx,
+                            const struct dchu_fan_pkg *pkg)
+{
+    u32 alarms = 0;
+    long lim;
+    int i;
+
+    for (i = 0; i < ctx->layout->nr_temps; i++) {
+        lim = READ_ONCE(ctx->temp_max[i]);
+        if (lim && pkg->temp[i] >= lim)
+            alarms |= BIT(DCHU_ALARM_TEMP_MAX + i);
+        lim = READ_ONCE(ctx->temp_crit[i]);
+        if (lim && pkg->temp[i] >= lim)
+            alarms |= BIT(DCHU_ALARM_TEMP_CRIT + i);
+    }
+    for (i = 0; i < ctx->layout->nr_fans; i++) {
+        lim = READ_ONCE(ctx->fan_min[i]);
+        if (lim && pkg->rpm[i] < lim)
+            alarms |= BIT(DCHU_ALARM_FAN + i);
+    }
+    return alarms;
+}
+
+/* sysfs_notify() + uevent on every alarm attribute that flipped */
+static void dchu_notify_alarms(struct dchu_hwmon_ctx *ctx, u32 changed)
+{
+    int i;
+
+    if (!changed || !ctx->hwdev)
+        return;
+    for (i = 0; i < ctx->layout->nr_temps; i++) {
+        if (changed & BIT(DCHU_ALARM_TEMP_MAX + i))
+            hwmon_notify_event(ctx->hwdev, hwmon_temp, hwmon_temp_max_alarm, i);
+        if (changed & BIT(DCHU_ALARM_TEMP_CRIT + i))
+            hwmon_notify_event(ctx->hwdev, hwmon_temp, hwmon_temp_crit_alarm, i);
+    }
+    for (i = 0; i < ctx->layout->nr_fans; i++)
+        if (changed & BIT(DCHU_ALARM_FAN + i))
+            hwmon_notify_event(ctx->hwdev, hwmon_fan, hwmon_fan_alarm, i);
+}
+
+/* Fold one decoded package into the history; caller holds ctx->lock */
+static void dchu_hist_add(struct dchu_hwmon_ctx *ctx, const struct dchu_fan_pkg *pkg)
+{
+    struct dchu_hist_sample *s = &ctx->hist_ring[ctx->hist_head++ % DCHU_HIST_LEN];
+    unsigned long now = jiffies, tau = msecs_to_jiffies(smooth_ms), dt;
+    struct dchu_hist *h;
+    long val;
+    int i;
+
+    s->stamp = now;
+    for (i = 0; i < DCHU_HIST_CHANS; i++) {
+        val = i < DCHU_HIST_TEMP ? pkg->rpm[i - DCHU_HIST_FAN]
+                                 : pkg->temp[i - DCHU_HIST_TEMP];
+        s->val[i] = val;
+        h = &ctx->hist[i];
+        dt = now - h->stamp;
+        if (!h->valid) {
+            h->lowest = h->highest = val;
+            h->ema = val * 256;
+            h->valid = true;
+        } else {
+            h->lowest = min(h->lowest, val);
+            h->highest = max(h->highest, val);
+            /* Time-aware EMA: alpha = dt / (tau + dt), so gaps weigh more */
+            if (!tau || dt >= 8 * tau)
+                h->ema = val * 256;
+            else
+                h->ema += div64_s64((s64)(val * 256 - h->ema) * dt, tau + dt);
+        }
+        h->stamp = now;
+    }
+}
+
+/* Mean of the ring samples within history_ms and after the last reset */
+static int dchu_hist_average(struct dchu_hwmon_ctx *ctx, int chan, long *val)
+{
+    unsigned long from = jiffies - msecs_to_jiffies(history_ms);
+    unsigned int k, lo = ctx->hist[chan].since;
+    const struct dchu_hist_sample *s;
+    s64 sum = 0;
+    int n = 0;
+
+    if (ctx->hist_head > DCHU_HIST_LEN)
+        lo = max(lo, ctx->hist_head - DCHU_HIST_LEN);
+    for (k = ctx->hist_head; k > lo; k--) {
+        s = &ctx->hist_ring[(k - 1) % DCHU_HIST_LEN];
+        if (time_before(s->stamp, from))
+            break;
+        sum += s->val[chan];
+        n++;
+    }
+    if (!n)
+        return -ENODATA;
+    *val = div_s64(sum, n);
+    return 0;
+}
+
+/* Evaluate _DSM 12 and publish the decoded package; caller holds ctx->lock */
+static int dchu_hwmon_refresh(struct dchu_hwmon_ctx *ctx)
+{
+    struct dchu_fan_pkg pkg;
+    u32 old = ctx->pkg.alarms;
+    int ret;
+
+    ret = dchu_get_dsm_buf(ctx->core, 12 /* FAN package */, ctx->buf,
+                           sizeof(ctx->buf), ctx->min_len, &ctx->len);
+    if (!ret) {
+        dchu_decode(ctx->layout, ctx->buf, &pkg);
+        pkg.alarms = dchu_eval_alarms(ctx, &pkg);
+    }
+
+    write_seqlock(&ctx->seq);
+    if (!ret)
+        ctx->pkg = pkg;
+    ctx->status = ret;
+    write_sequnlock(&ctx->seq);
+
+    ctx->stamp = jiffies;
+    ctx->valid = !ret;
+    if (!ret) {
+        dchu_hist_add(ctx, &pkg);
+        dchu_notify_alarms(ctx, old ^ pkg.alarms);
+    }
+    return ret;
+}
+
+/* Refresh the FAN package snapshot when stale; caller holds ctx->lock */
+static int dchu_hwmon_update(struct dchu_hwmon_ctx *ctx)
+{
+    if (ctx->valid && cache_ms &&
+        time_before(jiffies, ctx->stamp + msecs_to_jiffies(cache_ms)))
         return 0;
-    return (long)DIV_ROUND_CLOSEST_ULL((u64)tach_hz * 60ULL,
-                                       (u64)ppr * (u64)raw);
+    return dchu_hwmon_refresh(ctx);
 }
 
-/* Helper: call _DSM and return buffer for given function id */
-static int dchu_get_dsm_buf(struct dchu *core, u64 function, u8 **buf, u32 *len, union acpi_object **holder)
+/* Sampler interval in ms; limits need sampling even without sample_ms */
+static unsigned int dchu_sample_interval(struct dchu_hwmon_ctx *ctx)
+{
+    if (sample_ms)
+        return sample_ms;
+    return READ_ONCE(ctx->limits) ? alarm_ms : 0;
+}
+
+static void dchu_hwmon_kick(struct dchu_hwmon_ctx *ctx)
+{
+    unsigned int ms = dchu_sample_interval(ctx);
+
+    /* Under lock so it cannot re-arm behind dchu_hwmon_detach() */
+    mutex_lock(&ctx->lock);
+    if (ms && !ctx->dying && !atomic_xchg(&ctx->sampling, 1))
+        queue_delayed_work(system_unbound_wq, &ctx->sampler,
+                           msecs_to_jiffies(ms));
+    mutex_unlock(&ctx->lock);
+}
+
+static void dchu_hwmon_sample(struct work_struct *work)
 {
-    union acpi_object *obj;
+    struct dchu_hwmon_ctx *ctx = container_of(to_delayed_work(work),
+                                              struct dchu_hwmon_ctx, sampler);
+    unsigned int ms = dchu_sample_interval(ctx);
+    bool dying;
+
+    mutex_lock(&ctx->lock);
+    dying = ctx->dying;
+    if (!dying)
+        dchu_hwmon_refresh(ctx);
+    mutex_unlock(&ctx->lock);
+
+    /* Park when disabled, going away or nobody looked for idle_s seconds */
+    if (!ms || dying || (!READ_ONCE(ctx->limits) &&
+                time_after(jiffies, READ_ONCE(ctx->last_read) + idle_s * HZ))) {
+        atomic_set(&ctx->sampling, 0);
+        return;
+    }
+    queue_delayed_work(system_unbound_wq, &ctx->sampler, msecs_to_jiffies(ms));
+}
+
+/*
+ * Copy out the current package. While the sampler runs this is a pure
+ * memory read; otherwise fall back to the cached on-demand path and
+ * (re)start the sampler if one is configured.
+ */
+static int dchu_hwmon_snapshot(struct dchu_hwmon_ctx *ctx,
+                               struct dchu_fan_pkg *pkg)
+{
+    unsigned int seq;
     int ret;
 
-    ret = dchu_call_dsm(core, function, NULL, 0, &obj);
+    WRITE_ONCE(ctx->last_read, jiffies);
+
+    if (atomic_read(&ctx->sampling)) {
+        do {
+            seq = read_seqbegin(&ctx->seq);
+            *pkg = ctx->pkg;
+            ret = ctx->status;
+        } while (read_seqretry(&ctx->seq, seq));
+        return ret;
+    }
+
+    mutex_lock(&ctx->lock);
+    ret = dchu_hwmon_update(ctx);
+    if (!ret)
+        *pkg = ctx->pkg;
+    mutex_unlock(&ctx->lock);
+
+    if (!ret)
+        dchu_hwmon_kick(ctx);
+    return ret;
+}
+
+static int dchu_hist_read(struct dchu_hwmon_ctx *ctx, int chan,
+                          enum dchu_hist_kind kind, long *val)
+{
+    struct dchu_fan_pkg pkg;
+    struct dchu_hist *h = &ctx->hist[chan];
+    int ret;
+
+    /* Counts as a reader: keeps samples (and so the history) coming */
+    ret = dchu_hwmon_snapshot(ctx, &pkg);
     if (ret)
         return ret;
 
-    if (!obj || obj->type != ACPI_TYPE_BUFFER)
-        goto bad;
+    mutex_lock(&ctx->lock);
+    if (!h->valid)
+        ret = -ENODATA;
+    else if (kind == DCHU_HIST_LOWEST)
+        *val = h->lowest;
+    else if (kind == DCHU_HIST_HIGHEST)
+        *val = h->highest;
+    else if (kind == DCHU_HIST_SMOOTHED)
+        *val = DIV_ROUND_CLOSEST(h->ema, 256);
+    else
+        ret = dchu_hist_average(ctx, chan, val);
+    mutex_unlock(&ctx->lock);
+    return ret;
+}
 
-    if (obj->buffer.length < 32)
-        goto bad;
+/* Forget one channel's history; the next sample starts a new one */
+static void dchu_hist_reset(struct dchu_hwmon_ctx *ctx, int chan)
+{
+    mutex_lock(&ctx->lock);
+    ctx->hist[chan].valid = false;
+    ctx->hist[chan].since = ctx->hist_head;
+    mutex_unlock(&ctx->lock);
+}
 
-    *buf = obj->buffer.pointer;
-    *len = obj->buffer.length;
-    *holder = obj; /* caller must kfree(*holder) */
-    return 0;
+static int dchu_set_fan_mode(struct dchu_hwmon_ctx *ctx, u8 mode)
+{
+    u8 payload[4];
 
-bad:
-    kfree(obj);
-    return -EIO;
+    dchu_fan_mode_payload(payload, mode);
+    return dchu_call_dsm(ctx->core, 121, payload, sizeof(payload), NULL);
 }
 
-static int dchu_read(struct device *dev, enum hwmon_sensor_types type,
-                     u32 attr, int channel, long *val)
+/*
+ * Duty writes need duty_control and a _DSM 0 bitmap that lists 104; an
+ * unknown bitmap is not enough here.
+ */
+static bool dchu_can_duty(const struct dchu_hwmon_ctx *ctx)
+{
+    return ctx->duty && ctx->core->funcs_known && test_bit(104, ctx->core->funcs);
+}
+
+/* Fan duty in custom mode: _DSM 104, payload[0..2] = duty 0..255 per fan */
+static int dchu_set_fan_duty(struct dchu_hwmon_ctx *ctx, const u8 *duty)
+{
+    u8 payload[4] = {0};
+
+    if (!dchu_can_duty(ctx))
+        return -EOPNOTSUPP;
+
+    memcpy(payload, duty, DCHU_NR_FANS);
+    return dchu_call_dsm(ctx->core, 104, payload, sizeof(payload), NULL);
+}
+
+/* Linear interpolation between points, flat outside the first/last one */
+static u8 dchu_curve_interp(const struct dchu_curve *c, long temp)
+{
+    long t0, t1;
+    int i;
+
+    if (temp <= c->temp[0])
+        return c->pwm[0];
+    for (i = 1; i < DCHU_CURVE_POINTS; i++) {
+        if (temp >= c->temp[i])
+            continue;
+        t0 = c->temp[i - 1];
+        t1 = c->temp[i];
+        return c->pwm[i - 1] +
+               ((long)c->pwm[i] - c->pwm[i - 1]) * (temp - t0) / (t1 - t0);
+    }
+    return c->pwm[DCHU_CURVE_POINTS - 1];
+}
+
+/*
+ * Next duty for one fan: rise with the curve, fall only once the temp
+ * is hyst below the point that justified the current duty, and move at
+ * most step units per tick either way.
+ */
+static u8 dchu_curve_step(const struct dchu_curve *c, long temp, u8 cur,
+                          unsigned int step)
+{
+    int up = dchu_curve_interp(c, temp);
+    int down = dchu_curve_interp(c, temp + c->hyst);
+    int target = cur;
+
+    if (up > cur)
+        target = up;
+    else if (down < cur)
+        target = down;
+    if (step)
+        target = clamp_t(int, target, cur - (int)step, cur + (int)step);
+    return clamp_t(int, target, 0, 255);
+}
+
+static void dchu_curve_work(struct work_struct *work)
+{
+    struct dchu_hwmon_ctx *ctx = container_of(to_delayed_work(work),
+                                              struct dchu_hwmon_ctx, curve_work);
+    unsigned int ms = max(curve_ms, 100U);
+    bool changed = false;
+    u8 duty[DCHU_NR_FANS] = { 0 };  /* fans the layout lacks get 0 */
+    unsigned int step;
+    int i, ret;
+
+    if (READ_ONCE(ctx->fan_mode) != DCHU_FAN_MODE_CUSTOM || READ_ONCE(ctx->manual))
+        return;
+
+    mutex_lock(&ctx->lock);
+    ret = dchu_hwmon_refresh(ctx);
+    for (i = 0; !ret && i < ctx->layout->nr_fans; i++) {
+        u8 cur = ctx->curve_live ? ctx->curve_duty[i] : ctx->pkg.pwm[i];
+
+        step = DIV_ROUND_UP(ctx->curve[i].ramp * ms, 1000);
+        duty[i] = dchu_curve_step(&ctx->curve[i], ctx->pkg.temp[i], cur, step);
+        changed |= duty[i] != cur;
+    }
+    mutex_unlock(&ctx->lock);
+
+    /* The first push takes over from whatever the EC was doing */
+    if (!ret && (changed || !ctx->curve_live)) {
+        ret = dchu_set_fan_duty(ctx, duty);
+        if (!ret) {
+            memcpy(ctx->curve_duty, duty, sizeof(duty));
+            ctx->curve_live = true;
+        }
+    }
+    if (ret)
+        dev_warn_ratelimited(ctx->hwdev, "fan curve update failed: %d\n", ret);
+
+    queue_delayed_work(system_unbound_wq, &ctx->curve_work, msecs_to_jiffies(ms));
+}
+
+/*
+ * (Re)start the engine after a mode change, or stop it outside curve
+ * mode; caller holds mode_lock. Never re-armed once detached.
+ */
+static void dchu_curve_arm(struct dchu_hwmon_ctx *ctx)
+{
+    cancel_delayed_work_sync(&ctx->curve_work);
+    ctx->curve_live = false;
+    if (!ctx->detached && ctx->fan_mode == DCHU_FAN_MODE_CUSTOM && !ctx->manual)
+        queue_delayed_work(system_unbound_wq, &ctx->curve_work, 0);
+}
+
+/* Duties change with the mode; don't serve the old package */
+static void dchu_hwmon_invalidate(struct dchu_hwmon_ctx *ctx)
+{
+    mutex_lock(&ctx->lock);
+    ctx->valid = false;
+    mutex_unlock(&ctx->lock);
+    if (atomic_read(&ctx->sampling))
+        mod_delayed_work(system_unbound_wq, &ctx->sampler, 0);
+}
+
+/* Driver side of a mode switch the EC accepted; caller holds mode_lock */
+static void dchu_mode_applied(struct dchu_hwmon_ctx *ctx, u8 mode, bool manual)
+{
+    WRITE_ONCE(ctx->fan_mode, mode);
+    WRITE_ONCE(ctx->manual, manual);
+    ctx->mode_set = true;
+    dchu_curve_arm(ctx);
+    dchu_hwmon_invalidate(ctx);
+}
+
+/* Switch the EC mode and who drives custom duties; caller holds mode_lock */
+static int dchu_apply_mode(struct dchu_hwmon_ctx *ctx, u8 mode, bool manual)
+{
+    int ret;
+
+    ret = dchu_set_fan_mode(ctx, mode);
+    if (!ret)
+        dchu_mode_applied(ctx, mode, manual);
+    return ret;
+}
+
+/* Completion of an async fan_mode store, on the core's ordered workqueue */
+static void dchu_fan_mode_done(const struct dchu_async_req *req, int ret)
+{
+    struct dchu_hwmon_ctx *ctx = req->data;
+
+    mutex_lock(&ctx->mode_lock);
+    if (!ret)
+        dchu_mode_applied(ctx, req->payload[0], false);
+    mutex_unlock(&ctx->mode_lock);
+
+    WRITE_ONCE(ctx->mode_err, ret);
+    if (ret) {
+        char env[32];
+        char *envp[] = { env, NULL };
+
+        snprintf(env, sizeof(env), "DCHU_FAN_MODE_ERROR=%d", ret);
+        sysfs_notify(&ctx->hwdev->kobj, NULL, "fan_mode_error");
+        kobject_uevent_env(&ctx->hwdev->kobj, KOBJ_CHANGE, envp);
+    }
+}
+
+/* hwmon pwmN_enable: 0 full, 1 manual, 2 EC automatic, 3 driver fan curve */
+VISIBLE_IF_KUNIT long dchu_pwm_enable_get(struct dchu_hwmon_ctx *ctx)
 {
-    /* Only used by legacy fan1_input sysfs helper below */
-    if (type == hwmon_fan && attr == hwmon_fan_input && channel == 0) {
-        struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-        u8 *buf; u32 len; union acpi_object *hold;
-        int ret = dchu_get_dsm_buf(ctx->core, 12 /* FAN package */, &buf, &len, &hold);
-        if (ret)
-            return ret;
-        /* CPU fan raw at [2],[3] */
-        *val = dchu_to_rpm(dchu_get16(buf, 2));
-        kfree(hold);
+    switch (READ_ONCE(ctx->fan_mode)) {
+    case DCHU_FAN_MODE_MAX:
         return 0;
+    case DCHU_FAN_MODE_CUSTOM:
+        return READ_ONCE(ctx->manual) ? 1 : 3;
+    default:
+        return 2;
     }
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_pwm_enable_get);
+
+VISIBLE_IF_KUNIT int dchu_pwm_enable_set(struct dchu_hwmon_ctx *ctx, long val)
+{
+    static const u8 modes[] = {
+        DCHU_FAN_MODE_MAX, DCHU_FAN_MODE_CUSTOM,
+        DCHU_FAN_MODE_AUTO, DCHU_FAN_MODE_CUSTOM,
+    };
+    struct dchu_fan_pkg pkg;
+    int ret, i;
+
+    if (val < 0 || val >= ARRAY_SIZE(modes))
+        return -EINVAL;
+    /* Manual and curve modes write duties */
+    if (modes[val] == DCHU_FAN_MODE_CUSTOM && !dchu_can_duty(ctx))
+        return -EOPNOTSUPP;
+
+    mutex_lock(&ctx->mode_lock);
+    if (ctx->detached) {
+        mutex_unlock(&ctx->mode_lock);
+        return -ENODEV;
+    }
+    /* Enter manual at the current duties; full speed if they are unknown */
+    if (val == 1 && !ctx->manual) {
+        ret = dchu_hwmon_snapshot(ctx, &pkg);
+        for (i = 0; i < ctx->layout->nr_fans; i++)
+            ctx->manual_duty[i] = ret ? 255 : pkg.pwm[i];
+    }
+    ret = dchu_apply_mode(ctx, modes[val], val == 1);
+    if (!ret && val == 1)
+        ret = dchu_set_fan_duty(ctx, ctx->manual_duty);
+    mutex_unlock(&ctx->mode_lock);
+    return ret;
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_pwm_enable_set);
 
-    return -EOPNOTSUPP;
+/* pwmN writes only take effect in manual mode (pwmN_enable = 1) */
+static int dchu_pwm_set(struct dchu_hwmon_ctx *ctx, int channel, long val)
+{
+    int ret = -EBUSY;
+
+    mutex_lock(&ctx->mode_lock);
+    if (ctx->detached) {
+        ret = -ENODEV;
+    } else if (ctx->fan_mode == DCHU_FAN_MODE_CUSTOM && ctx->manual) {
+        ctx->manual_duty[channel] = clamp_val(val, 0, 255);
+        ret = dchu_set_fan_duty(ctx, ctx->manual_duty);
+    }
+    mutex_unlock(&ctx->mode_lock);
+    if (!ret)
+        dchu_hwmon_invalidate(ctx);
+    return ret;
 }
 
-/* (obsolete) hwmon info approach kept for reference was removed */
+static long *dchu_limit(struct dchu_hwmon_ctx *ctx, enum hwmon_sensor_types type,
+                        u32 attr, int channel)
+{
+    if (type == hwmon_temp && attr == hwmon_temp_max)
+        return &ctx->temp_max[channel];
+    if (type == hwmon_temp && attr == hwmon_temp_crit)
+        return &ctx->temp_crit[channel];
+    if (type == hwmon_fan && attr == hwmon_fan_min)
+        return &ctx->fan_min[channel];
+    return NULL;
+}
 
-/* Legacy sysfs path using groups to avoid strict hwmon_info checks */
-static ssize_t fan1_input_show(struct device *dev,
-                               struct device_attribute *attr, char *buf)
+static int dchu_read(struct device *dev, enum hwmon_sensor_types type,
+                     u32 attr, int channel, long *val)
 {
-    long val;
-    int ret = dchu_read(dev, hwmon_fan, hwmon_fan_input, 0, &val);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    struct dchu_fan_pkg pkg;
+    long *lim;
+    int ret;
+
+    lim = dchu_limit(ctx, type, attr, channel);
+    if (lim) {
+        *val = READ_ONCE(*lim);
+        return 0;
+    }
+    if (type == hwmon_pwm && attr == hwmon_pwm_enable) {
+        *val = dchu_pwm_enable_get(ctx);
+        return 0;
+    }
+    if (type == hwmon_temp && attr == hwmon_temp_lowest)
+        return dchu_hist_read(ctx, DCHU_HIST_TEMP + channel, DCHU_HIST_LOWEST, val);
+    if (type == hwmon_temp && attr == hwmon_temp_highest)
+        return dchu_hist_read(ctx, DCHU_HIST_TEMP + channel, DCHU_HIST_HIGHEST, val);
+
+    ret = dchu_hwmon_snapshot(ctx, &pkg);
     if (ret)
         return ret;
-    return sysfs_emit(buf, "%ld\n", val);
+
+    switch (type) {
+    case hwmon_fan:
+        if (attr == hwmon_fan_alarm)
+            *val = !!(pkg.alarms & BIT(DCHU_ALARM_FAN + channel));
+        else
+            *val = pkg.rpm[channel];
+        return 0;
+    case hwmon_pwm:
+        *val = pkg.pwm[channel];
+        return 0;
+    case hwmon_temp:
+        if (attr == hwmon_temp_max_alarm)
+            *val = !!(pkg.alarms & BIT(DCHU_ALARM_TEMP_MAX + channel));
+        else if (attr == hwmon_temp_crit_alarm)
+            *val = !!(pkg.alarms & BIT(DCHU_ALARM_TEMP_CRIT + channel));
+        else
+            *val = pkg.temp[channel];
+        return 0;
+    default:
+        return -EOPNOTSUPP;
+    }
+}
+
+static int dchu_write(struct device *dev, enum hwmon_sensor_types type,
+                      u32 attr, int channel, long val)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    long *lim = dchu_limit(ctx, type, attr, channel);
+    bool any = false;
+    int i;
+
+    if (type == hwmon_pwm && attr == hwmon_pwm_enable)
+        return dchu_pwm_enable_set(ctx, val);
+    if (type == hwmon_pwm && attr == hwmon_pwm_input)
+        return dchu_pwm_set(ctx, channel, val);
+    if (type == hwmon_temp && attr == hwmon_temp_reset_history) {
+        dchu_hist_reset(ctx, DCHU_HIST_TEMP + channel);
+        return 0;
+    }
+    if (!lim)
+        return -EOPNOTSUPP;
+
+    val = clamp_val(val, 0, type == hwmon_temp ? 255000L : 65535L);
+
+    mutex_lock(&ctx->lock);
+    WRITE_ONCE(*lim, val);
+    for (i = 0; i < DCHU_NR_TEMPS; i++)
+        any |= ctx->temp_max[i] || ctx->temp_crit[i];
+    for (i = 0; i < DCHU_NR_FANS; i++)
+        any |= !!ctx->fan_min[i];
+    WRITE_ONCE(ctx->limits, any);
+    mutex_unlock(&ctx->lock);
+
+    dchu_hwmon_kick(ctx);
+    return 0;
 }
-static DEVICE_ATTR_RO(fan1_input);
 
-/* Additional attributes following the parse table (package 12) */
-static ssize_t fan2_input_show(struct device *dev,
-                               struct device_attribute *attr, char *buf)
+static int dchu_read_string(struct device *dev, enum hwmon_sensor_types type,
+                            u32 attr, int channel, const char **str)
 {
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; long rpm; int ret;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    rpm = dchu_to_rpm(dchu_get16(b, 4));
-    kfree(h);
-    return sysfs_emit(buf, "%ld\n", rpm);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+
+    switch (type) {
+    case hwmon_fan:
+        *str = ctx->layout->fan_label[channel];
+        return 0;
+    case hwmon_temp:
+        *str = ctx->layout->temp_label[channel];
+        return 0;
+    default:
+        return -EOPNOTSUPP;
+    }
 }
-static DEVICE_ATTR_RO(fan2_input);
 
-static ssize_t fan3_input_show(struct device *dev,
-                               struct device_attribute *attr, char *buf)
+/* Full fan control needs the mode function (121) and duty writes (104) */
+static bool dchu_can_control(const struct dchu_hwmon_ctx *ctx)
 {
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; long rpm; int ret;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    rpm = dchu_to_rpm(dchu_get16(b, 6));
-    kfree(h);
-    return sysfs_emit(buf, "%ld\n", rpm);
+    return dchu_has_func(ctx->core, 121) && dchu_can_duty(ctx);
 }
-static DEVICE_ATTR_RO(fan3_input);
+
+static umode_t dchu_is_visible(const void *data, enum hwmon_sensor_types type,
+                               u32 attr, int channel)
+{
+    const struct dchu_hwmon_ctx *ctx = data;
+    const struct dchu_layout *l = ctx->layout;
+
+    /* Channels the model's layout does not have */
+    if ((type == hwmon_temp && channel >= l->nr_temps) ||
+        ((type == hwmon_fan || type == hwmon_pwm) && channel >= l->nr_fans))
+        return 0;
+
+    switch (type) {
+    case hwmon_fan:
+        if (attr == hwmon_fan_min)
+            return 0644;
+        if (attr == hwmon_fan_input || attr == hwmon_fan_label ||
+            attr == hwmon_fan_alarm)
+            return 0444;
+        break;
+    case hwmon_pwm:
+        if (attr == hwmon_pwm_input)
+            return dchu_can_control(ctx) ? 0644 : 0444;
+        /* 0 and 2 (max, EC auto) only need the mode function */
+        if (attr == hwmon_pwm_enable && dchu_has_func(ctx->core, 121))
+            return 0644;
+        break;
+    case hwmon_temp:
+        if (attr == hwmon_temp_max || attr == hwmon_temp_crit)
+            return 0644;
+        if (attr == hwmon_temp_input || attr == hwmon_temp_label ||
+            attr == hwmon_temp_max_alarm || attr == hwmon_temp_crit_alarm ||
+            attr == hwmon_temp_lowest || attr == hwmon_temp_highest)
+            return 0444;
+        if (attr == hwmon_temp_reset_history)
+            return 0200;
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+#define DCHU_PWM_ATTRS  (HWMON_PWM_INPUT | HWMON_PWM_ENABLE)
+#define DCHU_FAN_ATTRS  (HWMON_F_INPUT | HWMON_F_LABEL | HWMON_F_MIN | HWMON_F_ALARM)
+#define DCHU_TEMP_ATTRS (HWMON_T_INPUT | HWMON_T_LABEL | HWMON_T_MAX | HWMON_T_CRIT | \
+                         HWMON_T_MAX_ALARM | HWMON_T_CRIT_ALARM | HWMON_T_LOWEST | \
+                         HWMON_T_HIGHEST | HWMON_T_RESET_HISTORY)
+
+static const struct hwmon_channel_info * const dchu_info[] = {
+    HWMON_CHANNEL_INFO(fan,
+                       DCHU_FAN_ATTRS,
+                       DCHU_FAN_ATTRS,
+                       DCHU_FAN_ATTRS),
+    HWMON_CHANNEL_INFO(pwm,
+                       DCHU_PWM_ATTRS,
+                       DCHU_PWM_ATTRS,
+                       DCHU_PWM_ATTRS),
+    HWMON_CHANNEL_INFO(temp,
+                       DCHU_TEMP_ATTRS,
+                       DCHU_TEMP_ATTRS,
+                       DCHU_TEMP_ATTRS),
+    NULL,
+};
+
+static const struct hwmon_ops dchu_hwmon_ops = {
+    .is_visible = dchu_is_visible,
+    .read = dchu_read,
+    .read_string = dchu_read_string,
+    .write = dchu_write,
+};
+
+static const struct hwmon_chip_info dchu_chip_info = {
+    .ops = &dchu_hwmon_ops,
+    .info = dchu_info,
+};
 
 /* Debug: dump raw buffer in hex to aid interpretation */
 static ssize_t fan_buf_show(struct device *dev,
                             struct device_attribute *attr, char *out)
 {
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; int ret; ssize_t pos = 0; u32 i;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    for (i = 0; i < l && pos < PAGE_SIZE - 4; i++)
-        pos += scnprintf(out + pos, PAGE_SIZE - pos, "%02x%s", b[i],
-                         (i + 1 < l) ? " " : "");
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    int ret; ssize_t pos = 0; u32 i;
+    mutex_lock(&ctx->lock);
+    ret = dchu_hwmon_update(ctx);
+    if (ret) {
+        mutex_unlock(&ctx->lock);
+        return ret;
+    }
+    for (i = 0; i < ctx->len && pos < PAGE_SIZE - 4; i++)
+        pos += scnprintf(out + pos, PAGE_SIZE - pos, "%02x%s", ctx->buf[i],
+                         (i + 1 < ctx->len) ? " " : "");
     pos += scnprintf(out + pos, PAGE_SIZE - pos, "\n");
-    kfree(h);
+    mutex_unlock(&ctx->lock);
     return pos;
 }
 static DEVICE_ATTR_RO(fan_buf);
 
-/* duty in package appears 0..100; expose as pwmX (0..255) */
-static ssize_t pwm1_show(struct device *dev,
-                         struct device_attribute *attr, char *buf)
-{
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; long pwm; int ret;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    pwm = (long)((b[16] * 255 + 50) / 100);
-    if (pwm > 255)
-        pwm = 255;
-    kfree(h);
-    return sysfs_emit(buf, "%ld\n", pwm);
-}
-static DEVICE_ATTR_RO(pwm1);
-
-static ssize_t pwm2_show(struct device *dev,
-                         struct device_attribute *attr, char *buf)
-{
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; long pwm; int ret;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    pwm = (long)((b[19] * 255 + 50) / 100);
-    if (pwm > 255)
-        pwm = 255;
-    kfree(h);
-    return sysfs_emit(buf, "%ld\n", pwm);
-}
-static DEVICE_ATTR_RO(pwm2);
-
-static ssize_t pwm3_show(struct device *dev,
-                         struct device_attribute *attr, char *buf)
-{
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; long pwm; int ret;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    pwm = (long)((b[22] * 255 + 50) / 100);
-    if (pwm > 255)
-        pwm = 255;
-    kfree(h);
-    return sysfs_emit(buf, "%ld\n", pwm);
-}
-static DEVICE_ATTR_RO(pwm3);
-
-/* temps in degrees C; expose in millidegrees */
-static ssize_t temp1_input_show(struct device *dev,
-                                struct device_attribute *attr, char *buf)
-{
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; long t; int ret;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    /* NOTE: Original uses CalCPUTemp(TDP, b[18]); here we expose raw */
-    t = (long)b[18] * 1000L;
-    kfree(h);
-    return sysfs_emit(buf, "%ld\n", t);
-}
-static DEVICE_ATTR_RO(temp1_input);
-
-static ssize_t temp2_input_show(struct device *dev,
-                                struct device_attribute *attr, char *buf)
-{
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; long t; int ret;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    t = (long)b[21] * 1000L;
-    kfree(h);
-    return sysfs_emit(buf, "%ld\n", t);
-}
-static DEVICE_ATTR_RO(temp2_input);
-
-static ssize_t temp3_input_show(struct device *dev,
-                                struct device_attribute *attr, char *buf)
-{
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
-    u8 *b; u32 l; union acpi_object *h; long t; int ret;
-    ret = dchu_get_dsm_buf(ctx->core, 12, &b, &l, &h);
-    if (ret) return ret;
-    t = (long)b[24] * 1000L;
-    kfree(h);
-    return sysfs_emit(buf, "%ld\n", t);
-}
-static DEVICE_ATTR_RO(temp3_input);
-
 /* Fan mode high (aka turbo): write 0/1 via _DSM command 121 with 1-byte payload */
 /* fan_mode_high removed */
 
@@ -259,18 +1049,42 @@ static const char *dchu_mode_name(u8 mode)
     }
 }
 
-static int dchu_set_fan_mode(struct dchu_hwmon_ctx *ctx, u8 mode)
+/* custom via fan_mode means the driver's fan curve */
+VISIBLE_IF_KUNIT int dchu_fan_mode_set(struct dchu_hwmon_ctx *ctx, u8 mode)
 {
-    u8 payload[4] = {0};
-    payload[0] = mode; /* data */
-    payload[3] = 1;    /* subcommand */
-    return dchu_call_dsm(ctx->core, 121, payload, sizeof(payload), NULL);
+    int ret;
+
+    switch (mode) {
+    case 0: case 1: case 3: case 5: case 7: break;
+    case 6:
+        /* The driver's curve writes duties */
+        if (!dchu_can_duty(ctx))
+            return -EOPNOTSUPP;
+        break;
+    default: return -ERANGE;
+    }
+
+    mutex_lock(&ctx->mode_lock);
+    if (ctx->detached) {
+        ret = -ENODEV;
+    } else if (READ_ONCE(async_mode)) {
+        u8 payload[4];
+
+        dchu_fan_mode_payload(payload, mode);
+        ret = dchu_call_dsm_async(ctx->core, 121, payload, sizeof(payload),
+                                  dchu_fan_mode_done, ctx);
+    } else {
+        ret = dchu_apply_mode(ctx, mode, false);
+    }
+    mutex_unlock(&ctx->mode_lock);
+    return ret;
 }
+EXPORT_SYMBOL_IF_KUNIT(dchu_fan_mode_set);
 
 static ssize_t fan_mode_show(struct device *dev,
                              struct device_attribute *attr, char *buf)
 {
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
     return sysfs_emit(buf, "%u\n", ctx->fan_mode);
 }
 
@@ -278,7 +1092,7 @@ static ssize_t fan_mode_store(struct device *dev,
                               struct device_attribute *attr,
                               const char *buf, size_t count)
 {
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
     unsigned long v; int ret; u8 mode;
 
     /* numeric? */
@@ -295,81 +1109,738 @@ static ssize_t fan_mode_store(struct device *dev,
         else return -EINVAL;
     }
 
-    switch (mode) {
-    case 0: case 1: case 3: case 5: case 6: case 7: break;
-    default: return -ERANGE;
-    }
-
-    ret = dchu_set_fan_mode(ctx, mode);
-    if (ret)
-        return ret;
-    ctx->fan_mode = mode;
-    return count;
+    ret = dchu_fan_mode_set(ctx, mode);
+    return ret ? ret : count;
 }
 static DEVICE_ATTR_RW(fan_mode);
 
+/* 0 or -errno of the last async fan_mode store; pollable */
+static ssize_t fan_mode_error_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(ctx->mode_err));
+}
+static DEVICE_ATTR_RO(fan_mode_error);
+
 static ssize_t fan_mode_name_show(struct device *dev,
                                   struct device_attribute *attr, char *buf)
 {
-    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev->parent);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
     return sysfs_emit(buf, "%s\n", dchu_mode_name(ctx->fan_mode));
 }
 static DEVICE_ATTR_RO(fan_mode_name);
 
+/* pwmN_auto_pointM_{temp,pwm}: nr = fan, index = point */
+static ssize_t dchu_point_temp_show(struct device *dev,
+                                    struct device_attribute *attr, char *buf)
+{
+    struct sensor_device_attribute_2 *sa = to_sensor_dev_attr_2(attr);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%ld\n", READ_ONCE(ctx->curve[sa->nr].temp[sa->index]));
+}
+
+static ssize_t dchu_point_temp_store(struct device *dev,
+                                     struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+    struct sensor_device_attribute_2 *sa = to_sensor_dev_attr_2(attr);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    struct dchu_curve *c = &ctx->curve[sa->nr];
+    long v;
+    int ret;
+
+    ret = kstrtol(buf, 10, &v);
+    if (ret)
+        return ret;
+    v = clamp_val(v, 0, 255000L);
+
+    /* Points must stay in ascending temperature order */
+    mutex_lock(&ctx->lock);
+    if ((sa->index > 0 && v <= c->temp[sa->index - 1]) ||
+        (sa->index < DCHU_CURVE_POINTS - 1 && v >= c->temp[sa->index + 1]))
+        ret = -EINVAL;
+    else
+        WRITE_ONCE(c->temp[sa->index], v);
+    mutex_unlock(&ctx->lock);
+    return ret ? ret : count;
+}
+
+static ssize_t dchu_point_pwm_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf)
+{
+    struct sensor_device_attribute_2 *sa = to_sensor_dev_attr_2(attr);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(ctx->curve[sa->nr].pwm[sa->index]));
+}
+
+static ssize_t dchu_point_pwm_store(struct device *dev,
+                                    struct device_attribute *attr,
+                                    const char *buf, size_t count)
+{
+    struct sensor_device_attribute_2 *sa = to_sensor_dev_attr_2(attr);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    u8 v;
+    int ret;
+
+    ret = kstrtou8(buf, 10, &v);
+    if (ret)
+        return ret;
+    mutex_lock(&ctx->lock);
+    WRITE_ONCE(ctx->curve[sa->nr].pwm[sa->index], v);
+    mutex_unlock(&ctx->lock);
+    return count;
+}
+
+/* pwmN_auto_point_temp_hyst (m°C) and pwmN_auto_ramp_rate (pwm units/s); nr = fan */
+static ssize_t dchu_curve_hyst_show(struct device *dev,
+                                    struct device_attribute *attr, char *buf)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    int fan = to_sensor_dev_attr_2(attr)->nr;
+
+    return sysfs_emit(buf, "%ld\n", READ_ONCE(ctx->curve[fan].hyst));
+}
+
+static ssize_t dchu_curve_hyst_store(struct device *dev,
+                                     struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    int fan = to_sensor_dev_attr_2(attr)->nr;
+    long v;
+    int ret;
+
+    ret = kstrtol(buf, 10, &v);
+    if (ret)
+        return ret;
+    mutex_lock(&ctx->lock);
+    WRITE_ONCE(ctx->curve[fan].hyst, clamp_val(v, 0, 50000L));
+    mutex_unlock(&ctx->lock);
+    return count;
+}
+
+static ssize_t dchu_curve_ramp_show(struct device *dev,
+                                    struct device_attribute *attr, char *buf)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    int fan = to_sensor_dev_attr_2(attr)->nr;
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(ctx->curve[fan].ramp));
+}
+
+static ssize_t dchu_curve_ramp_store(struct device *dev,
+                                     struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    int fan = to_sensor_dev_attr_2(attr)->nr;
+    unsigned int v;
+    int ret;
+
+    ret = kstrtouint(buf, 10, &v);
+    if (ret)
+        return ret;
+    mutex_lock(&ctx->lock);
+    WRITE_ONCE(ctx->curve[fan].ramp, min(v, 255U));
+    mutex_unlock(&ctx->lock);
+    return count;
+}
+
+#define DCHU_POINT_ATTRS(f, p) \
+    static SENSOR_DEVICE_ATTR_2_RW(pwm##f##_auto_point##p##_temp, dchu_point_temp, f - 1, p - 1); \
+    static SENSOR_DEVICE_ATTR_2_RW(pwm##f##_auto_point##p##_pwm, dchu_point_pwm, f - 1, p - 1)
+
+#define DCHU_CURVE_ATTRS(f) \
+    DCHU_POINT_ATTRS(f, 1); DCHU_POINT_ATTRS(f, 2); DCHU_POINT_ATTRS(f, 3); \
+    DCHU_POINT_ATTRS(f, 4); DCHU_POINT_ATTRS(f, 5); DCHU_POINT_ATTRS(f, 6); \
+    static SENSOR_DEVICE_ATTR_2_RW(pwm##f##_auto_point_temp_hyst, dchu_curve_hyst, f - 1, 0); \
+    static SENSOR_DEVICE_ATTR_2_RW(pwm##f##_auto_ramp_rate, dchu_curve_ramp, f - 1, 0)
+
+DCHU_CURVE_ATTRS(1);
+DCHU_CURVE_ATTRS(2);
+DCHU_CURVE_ATTRS(3);
+
+#define DCHU_POINT_ATTR_LIST(f, p) \
+    &sensor_dev_attr_pwm##f##_auto_point##p##_temp.dev_attr.attr, \
+    &sensor_dev_attr_pwm##f##_auto_point##p##_pwm.dev_attr.attr
+
+#define DCHU_CURVE_ATTR_LIST(f) \
+    DCHU_POINT_ATTR_LIST(f, 1), DCHU_POINT_ATTR_LIST(f, 2), \
+    DCHU_POINT_ATTR_LIST(f, 3), DCHU_POINT_ATTR_LIST(f, 4), \
+    DCHU_POINT_ATTR_LIST(f, 5), DCHU_POINT_ATTR_LIST(f, 6), \
+    &sensor_dev_attr_pwm##f##_auto_point_temp_hyst.dev_attr.attr, \
+    &sensor_dev_attr_pwm##f##_auto_ramp_rate.dev_attr.attr
+
+/*
+ * History without a standard hwmon attribute: fanN_{lowest,highest,average,
+ * smoothed}, fanN_reset_history and tempN_average. nr = history channel.
+ */
+static ssize_t dchu_hist_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct sensor_device_attribute_2 *sa = to_sensor_dev_attr_2(attr);
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    long val;
+    int ret;
+
+    ret = dchu_hist_read(ctx, sa->nr, sa->index, &val);
+    return ret ? ret : sysfs_emit(buf, "%ld\n", val);
+}
+
+static ssize_t dchu_hist_reset_store(struct device *dev,
+                                     struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+
+    dchu_hist_reset(ctx, to_sensor_dev_attr_2(attr)->nr);
+    return count;
+}
+
+#define DCHU_FAN_HIST_ATTRS(f) \
+    static SENSOR_DEVICE_ATTR_2_RO(fan##f##_lowest, dchu_hist, DCHU_HIST_FAN + f - 1, DCHU_HIST_LOWEST); \
+    static SENSOR_DEVICE_ATTR_2_RO(fan##f##_highest, dchu_hist, DCHU_HIST_FAN + f - 1, DCHU_HIST_HIGHEST); \
+    static SENSOR_DEVICE_ATTR_2_RO(fan##f##_average, dchu_hist, DCHU_HIST_FAN + f - 1, DCHU_HIST_AVERAGE); \
+    static SENSOR_DEVICE_ATTR_2_RO(fan##f##_smoothed, dchu_hist, DCHU_HIST_FAN + f - 1, DCHU_HIST_SMOOTHED); \
+    static SENSOR_DEVICE_ATTR_2_WO(fan##f##_reset_history, dchu_hist_reset, DCHU_HIST_FAN + f - 1, 0)
+
+#define DCHU_TEMP_HIST_ATTRS(t) \
+    static SENSOR_DEVICE_ATTR_2_RO(temp##t##_average, dchu_hist, DCHU_HIST_TEMP + t - 1, DCHU_HIST_AVERAGE)
+
+DCHU_FAN_HIST_ATTRS(1);
+DCHU_FAN_HIST_ATTRS(2);
+DCHU_FAN_HIST_ATTRS(3);
+DCHU_TEMP_HIST_ATTRS(1);
+DCHU_TEMP_HIST_ATTRS(2);
+DCHU_TEMP_HIST_ATTRS(3);
+
+#define DCHU_FAN_HIST_ATTR_LIST(f) \
+    &sensor_dev_attr_fan##f##_lowest.dev_attr.attr, \
+    &sensor_dev_attr_fan##f##_highest.dev_attr.attr, \
+    &sensor_dev_attr_fan##f##_average.dev_attr.attr, \
+    &sensor_dev_attr_fan##f##_smoothed.dev_attr.attr, \
+    &sensor_dev_attr_fan##f##_reset_history.dev_attr.attr
+
+/*
+ * Driver-specific extras next to the standard hwmon attributes, one
+ * group per kind. Every curve and history attribute is a
+ * sensor_device_attribute_2 whose nr names its channel.
+ */
 static struct attribute *dchu_attrs[] = {
-    &dev_attr_fan1_input.attr,
-    &dev_attr_fan2_input.attr,
-    &dev_attr_fan3_input.attr,
     &dev_attr_fan_buf.attr,
-    &dev_attr_pwm1.attr,
-    &dev_attr_pwm2.attr,
-    &dev_attr_pwm3.attr,
-    &dev_attr_temp1_input.attr,
-    &dev_attr_temp2_input.attr,
-    &dev_attr_temp3_input.attr,
     &dev_attr_fan_mode.attr,
     &dev_attr_fan_mode_name.attr,
+    &dev_attr_fan_mode_error.attr,
+    NULL,
+};
+
+static struct attribute *dchu_curve_attrs[] = {
+    DCHU_CURVE_ATTR_LIST(1),
+    DCHU_CURVE_ATTR_LIST(2),
+    DCHU_CURVE_ATTR_LIST(3),
+    NULL,
+};
+
+static struct attribute *dchu_hist_attrs[] = {
+    DCHU_FAN_HIST_ATTR_LIST(1),
+    DCHU_FAN_HIST_ATTR_LIST(2),
+    DCHU_FAN_HIST_ATTR_LIST(3),
+    &sensor_dev_attr_temp1_average.dev_attr.attr,
+    &sensor_dev_attr_temp2_average.dev_attr.attr,
+    &sensor_dev_attr_temp3_average.dev_attr.attr,
     NULL,
 };
 
+static int dchu_attr_nr(struct attribute *attr)
+{
+    struct device_attribute *da = container_of(attr, struct device_attribute, attr);
+
+    return to_sensor_dev_attr_2(da)->nr;
+}
+
+/* fan_mode* need the mode function */
+static umode_t dchu_attr_visible(struct kobject *kobj, struct attribute *attr, int n)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(kobj_to_dev(kobj));
+
+    if (attr == &dev_attr_fan_buf.attr)
+        return attr->mode;
+    return dchu_has_func(ctx->core, 121) ? attr->mode : 0;
+}
+
+/* The pwmN_auto_* curve needs fan control, and fan N in the layout */
+static umode_t dchu_curve_visible(struct kobject *kobj, struct attribute *attr, int n)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(kobj_to_dev(kobj));
+
+    if (dchu_attr_nr(attr) >= ctx->layout->nr_fans)
+        return 0;
+    return dchu_can_control(ctx) ? attr->mode : 0;
+}
+
+/* History channels follow the layout like the standard attributes */
+static umode_t dchu_hist_visible(struct kobject *kobj, struct attribute *attr, int n)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(kobj_to_dev(kobj));
+    int chan = dchu_attr_nr(attr);
+
+    if (chan < DCHU_HIST_TEMP)
+        return chan - DCHU_HIST_FAN < ctx->layout->nr_fans ? attr->mode : 0;
+    return chan - DCHU_HIST_TEMP < ctx->layout->nr_temps ? attr->mode : 0;
+}
+
 static const struct attribute_group dchu_group = {
     .attrs = dchu_attrs,
+    .is_visible = dchu_attr_visible,
+};
+
+static const struct attribute_group dchu_curve_group = {
+    .attrs = dchu_curve_attrs,
+    .is_visible = dchu_curve_visible,
+};
+
+static const struct attribute_group dchu_hist_group = {
+    .attrs = dchu_hist_attrs,
+    .is_visible = dchu_hist_visible,
 };
 
 static const struct attribute_group *dchu_groups[] = {
     &dchu_group,
+    &dchu_curve_group,
+    &dchu_hist_group,
     NULL,
 };
 
+#ifdef DCHU_THERMAL
+/*
+ * Cooling states, quietest first. Trip points of every zone escalate
+ * silent -> auto -> max; below the first trip the governor picks silent.
+ */
+static const u8 dchu_cool_modes[] = {
+    DCHU_FAN_MODE_SILENT, DCHU_FAN_MODE_AUTO, DCHU_FAN_MODE_MAX,
+};
+
+/* Default trips per zone: temperature (m°C) and the state they ask for */
+static const struct thermal_trip dchu_trips_def[] = {
+    { .type = THERMAL_TRIP_ACTIVE, .temperature = 60000, .hysteresis = 5000,
+      .flags = THERMAL_TRIP_FLAG_RW_TEMP, .priv = (void *)1 },
+    { .type = THERMAL_TRIP_ACTIVE, .temperature = 85000, .hysteresis = 5000,
+      .flags = THERMAL_TRIP_FLAG_RW_TEMP, .priv = (void *)2 },
+};
+
+static int dchu_cool_index(u8 mode)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(dchu_cool_modes); i++)
+        if (dchu_cool_modes[i] == mode)
+            return i;
+    return -1;
+}
+
+static int dchu_cool_get_max_state(struct thermal_cooling_device *cdev,
+                                   unsigned long *state)
+{
+    *state = ARRAY_SIZE(dchu_cool_modes) - 1;
+    return 0;
+}
+
+static int dchu_cool_get_cur_state(struct thermal_cooling_device *cdev,
+                                   unsigned long *state)
+{
+    struct dchu_hwmon_ctx *ctx = cdev->devdata;
+    int i = dchu_cool_index(READ_ONCE(ctx->fan_mode));
+
+    *state = i < 0 ? READ_ONCE(ctx->cool_state) : i;
+    return 0;
+}
+
+/* Give back the mode the governor found, unless the user changed it since */
+static int dchu_cool_release(struct dchu_hwmon_ctx *ctx)
+{
+    int ret = 0;
+
+    lockdep_assert_held(&ctx->mode_lock);
+    if (ctx->cool_base >= 0 && ctx->fan_mode == ctx->cool_mode &&
+        ctx->fan_mode != ctx->cool_base)
+        ret = dchu_apply_mode(ctx, ctx->cool_base, false);
+    ctx->cool_base = -1;
+    return ret;
+}
+
+/*
+ * Only steers the EC while it runs one of the ladder's modes. Custom,
+ * manual, turbo or maxq set through hwmon put the governor on hold
+ * until fan_mode is back on silent, auto or max. A trip only ever
+ * raises the fans above the mode the user picked, which is saved when
+ * the first trip fires and restored once the state is back to 0.
+ */
+static int dchu_cool_set_cur_state(struct thermal_cooling_device *cdev,
+                                   unsigned long state)
+{
+    struct dchu_hwmon_ctx *ctx = cdev->devdata;
+    int cur, ret = 0;
+    u8 mode;
+
+    if (state >= ARRAY_SIZE(dchu_cool_modes))
+        return -EINVAL;
+
+    mutex_lock(&ctx->mode_lock);
+    WRITE_ONCE(ctx->cool_state, state);
+    cur = dchu_cool_index(ctx->fan_mode);
+    if (ctx->detached) {
+        ret = -ENODEV;
+    } else if (cur < 0) {
+        /* On hold; nothing left to give back either */
+        ctx->cool_base = -1;
+    } else if (!state) {
+        ret = dchu_cool_release(ctx);
+    } else {
+        /* A mode set through hwmon since the last trip is the new base */
+        if (ctx->cool_base < 0 || ctx->fan_mode != ctx->cool_mode)
+            ctx->cool_base = ctx->fan_mode;
+        mode = dchu_cool_modes[max_t(int, state, dchu_cool_index(ctx->cool_base))];
+        ctx->cool_mode = mode;
+        if (ctx->fan_mode != mode)
+            ret = dchu_apply_mode(ctx, mode, false);
+    }
+    mutex_unlock(&ctx->mode_lock);
+    return ret;
+}
+
+static const struct thermal_cooling_device_ops dchu_cool_ops = {
+    .get_max_state = dchu_cool_get_max_state,
+    .get_cur_state = dchu_cool_get_cur_state,
+    .set_cur_state = dchu_cool_set_cur_state,
+};
+
+static int dchu_tz_get_temp(struct thermal_zone_device *tzd, int *temp)
+{
+    struct dchu_tz *tz = thermal_zone_device_priv(tzd);
+    struct dchu_fan_pkg pkg;
+    int ret;
+
+    /* Same cached snapshot as the hwmon files */
+    ret = dchu_hwmon_snapshot(tz->ctx, &pkg);
+    if (!ret)
+        *temp = pkg.temp[tz->channel];
+    return ret;
+}
+
+/* Every trip binds the fan, pinned to the state in trip->priv */
+static bool dchu_tz_should_bind(struct thermal_zone_device *tzd,
+                                const struct thermal_trip *trip,
+                                struct thermal_cooling_device *cdev,
+                                struct cooling_spec *c)
+{
+    struct dchu_tz *tz = thermal_zone_device_priv(tzd);
+
+    if (cdev != tz->ctx->cdev)
+        return false;
+    c->lower = c->upper = (uintptr_t)trip->priv;
+    return true;
+}
+
+static const struct thermal_zone_device_ops dchu_tz_ops = {
+    .get_temp = dchu_tz_get_temp,
+    .should_bind = dchu_tz_should_bind,
+};
+
+static void dchu_thermal_remove(void *data)
+{
+    struct dchu_hwmon_ctx *ctx = data;
+    int i;
+
+    for (i = 0; i < DCHU_NR_TEMPS; i++)
+        if (ctx->tz[i].tzd)
+            thermal_zone_device_unregister(ctx->tz[i].tzd);
+    if (ctx->cdev)
+        thermal_cooling_device_unregister(ctx->cdev);
+
+    /* Runs before detach, with hwmon still there: undo the governor's mode */
+    mutex_lock(&ctx->mode_lock);
+    dchu_cool_release(ctx);
+    mutex_unlock(&ctx->mode_lock);
+}
+
+/*
+ * One zone per temp channel ("dchu_cpu", ...) polled every thermal_ms,
+ * plus the fan cooling device when the EC takes mode changes. Optional:
+ * failures only cost the in-kernel control.
+ */
+static void dchu_thermal_init(struct device *dev, struct dchu_hwmon_ctx *ctx)
+{
+    struct thermal_zone_device *tzd;
+    struct thermal_cooling_device *cdev;
+    char type[THERMAL_NAME_LENGTH];
+    char *p;
+    int i;
+
+    if (!thermal_ms)
+        return;
+    if (devm_add_action(dev, dchu_thermal_remove, ctx))
+        return;
+
+    if (dchu_has_func(ctx->core, 121)) {
+        cdev = thermal_cooling_device_register("dchu-fan", ctx, &dchu_cool_ops);
+        if (IS_ERR(cdev))
+            dev_warn(dev, "no fan cooling device: %ld\n", PTR_ERR(cdev));
+        else
+            ctx->cdev = cdev;
+    }
+
+    for (i = 0; i < ctx->layout->nr_temps; i++) {
+        snprintf(type, sizeof(type), "dchu_%s", ctx->layout->temp_label[i]);
+        for (p = type; *p; p++)
+            *p = tolower(*p);
+        ctx->tz[i].ctx = ctx;
+        ctx->tz[i].channel = i;
+        tzd = thermal_zone_device_register_with_trips(type, dchu_trips_def,
+                                                      ARRAY_SIZE(dchu_trips_def),
+                                                      &ctx->tz[i], &dchu_tz_ops,
+                                                      NULL, 0, thermal_ms);
+        if (IS_ERR(tzd)) {
+            dev_warn(dev, "no thermal zone %s: %ld\n", type, PTR_ERR(tzd));
+            continue;
+        }
+        ctx->tz[i].tzd = tzd;
+        if (thermal_zone_device_enable(tzd))
+            dev_warn(dev, "thermal zone %s not enabled\n", type);
+    }
+}
+#else
+static void dchu_thermal_init(struct device *dev, struct dchu_hwmon_ctx *ctx)
+{
+    if (thermal_ms)
+        dev_info_once(dev, "thermal_ms ignored: needs CONFIG_THERMAL and kernel 6.12+\n");
+}
+#endif
+
+static void dchu_hwmon_stop(void *data)
+{
+    struct dchu_hwmon_ctx *ctx = data;
+
+    /* Nobody drives the duties once we are gone; hand them back to the EC */
+    if (ctx->fan_mode == DCHU_FAN_MODE_CUSTOM)
+        dchu_set_fan_mode(ctx, DCHU_FAN_MODE_AUTO);
+}
+
+/*
+ * Any EC event may come with firmware-side fan changes (profile keys,
+ * thermal policy), and there is no _DSM to read the mode back: drop the
+ * snapshot so the next read or sample sees the new duties, and wake
+ * pollers of the duty attributes.
+ */
+static int dchu_hwmon_event(struct notifier_block *nb, unsigned long code, void *data)
+{
+    struct dchu_hwmon_ctx *ctx = container_of(nb, struct dchu_hwmon_ctx, nb);
+    int i;
+
+    if (dchu_event_kbd_light(code))
+        return NOTIFY_DONE;
+    dchu_hwmon_invalidate(ctx);
+    for (i = 0; i < ctx->layout->nr_fans; i++)
+        hwmon_notify_event(ctx->hwdev, hwmon_pwm, hwmon_pwm_input, i);
+    return NOTIFY_OK;
+}
+
+/*
+ * Runs before hwmon goes away: stop everything that can reach hwdev
+ * (sampler alarms, the curve engine, async callbacks, EC events) while
+ * it still exists.
+ */
+static void dchu_hwmon_detach(void *data)
+{
+    struct dchu_hwmon_ctx *ctx = data;
+
+    dchu_unregister_notifier(ctx->core, &ctx->nb);
+
+    mutex_lock(&ctx->mode_lock);
+    ctx->detached = true;
+    mutex_unlock(&ctx->mode_lock);
+    dchu_flush_async(ctx->core);
+    /* detached keeps dchu_curve_arm() from queueing it again */
+    cancel_delayed_work_sync(&ctx->curve_work);
+
+    mutex_lock(&ctx->lock);
+    ctx->dying = true;
+    mutex_unlock(&ctx->lock);
+    cancel_delayed_work_sync(&ctx->sampler);
+}
+
+/* Context state short of any registration; shared with the KUnit hook */
+static void dchu_hwmon_setup(struct dchu_hwmon_ctx *ctx, struct dchu *core,
+                             const struct dchu_layout *layout, bool duty)
+{
+    int i;
+
+    ctx->core = core;
+    ctx->layout = layout;
+    ctx->min_len = dchu_layout_min_len(layout);
+    ctx->duty = duty;
+    ctx->cool_base = -1;
+    mutex_init(&ctx->lock);
+    mutex_init(&ctx->mode_lock);
+    seqlock_init(&ctx->seq);
+    INIT_DELAYED_WORK(&ctx->sampler, dchu_hwmon_sample);
+    INIT_DELAYED_WORK(&ctx->curve_work, dchu_curve_work);
+    for (i = 0; i < layout->nr_fans; i++)
+        ctx->curve[i] = dchu_curve_def;
+}
+
+#if IS_ENABLED(CONFIG_KUNIT)
+/*
+ * A U4 UD context on core without hwmon, notifier or thermal zones,
+ * torn down like probe's when dev goes away; for dchu_kunit.
+ */
+struct dchu_hwmon_ctx *dchu_hwmon_kunit_create(struct device *dev, struct dchu *core,
+                                               bool duty)
+{
+    struct dchu_hwmon_ctx *ctx;
+
+    ctx = devm_kzalloc(dev, sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return NULL;
+    dchu_hwmon_setup(ctx, core, &dchu_layout_u4ud, duty);
+    ctx->hwdev = dev;
+    if (devm_add_action_or_reset(dev, dchu_hwmon_stop, ctx) ||
+        devm_add_action_or_reset(dev, dchu_hwmon_detach, ctx))
+        return NULL;
+    return ctx;
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_hwmon_kunit_create);
+#endif
+
 static int dchu_hwmon_probe(struct platform_device *pdev)
 {
     struct dchu_hwmon_ctx *ctx;
     struct dchu_cell_pdata *pdata = dev_get_platdata(&pdev->dev);
+    const struct dmi_system_id *id;
+    int ret;
 
     if (!pdata || !pdata->core)
         return -ENODEV;
 
+    if (!dchu_has_func(pdata->core, 12)) {
+        dev_info(&pdev->dev, "firmware has no FAN package (_DSM 12)\n");
+        return -ENODEV;
+    }
     ctx = devm_kzalloc(&pdev->dev, sizeof(*ctx), GFP_KERNEL);
     if (!ctx)
         return -ENOMEM;
 
-    ctx->core = pdata->core;
+    id = dmi_first_match(dchu_layout_dmi);
+    dchu_hwmon_setup(ctx, pdata->core, id ? id->driver_data : &dchu_layout_u4ud,
+                     duty_control);
+
+    /* Last thing to run on unbind, once hwmon and its readers are gone */
+    ret = devm_add_action(&pdev->dev, dchu_hwmon_stop, ctx);
+    if (ret)
+        return ret;
 
-    ctx->hwdev = devm_hwmon_device_register_with_groups(&pdev->dev, "dchu",
-                                                        NULL, dchu_groups);
+    ctx->hwdev = devm_hwmon_device_register_with_info(&pdev->dev, "dchu", ctx,
+                                                      &dchu_chip_info,
+                                                      dchu_groups);
     if (IS_ERR(ctx->hwdev))
         return PTR_ERR(ctx->hwdev);
 
+    /* Right after hwmon, so it runs before hwdev is unregistered */
+    ret = devm_add_action_or_reset(&pdev->dev, dchu_hwmon_detach, ctx);
+    if (ret)
+        return ret;
+    ctx->nb.notifier_call = dchu_hwmon_event;
+    ret = dchu_register_notifier(ctx->core, &ctx->nb);
+    if (ret)
+        return ret;
+
+    /* After detach, so zones and the cooling device go away first */
+    dchu_thermal_init(&pdev->dev, ctx);
+
     platform_set_drvdata(pdev, ctx);
-    dev_info(&pdev->dev, "dchu-hwmon initialized\n");
+    /* Resume only queues work; let it run alongside other devices */
+    device_enable_async_suspend(&pdev->dev);
+    dev_info(&pdev->dev, "dchu-hwmon initialized (%s layout%s)\n", ctx->layout->name,
+             id ? "" : ", no DMI match");
     return 0;
 }
 
 static void dchu_hwmon_remove(struct platform_device *pdev) { }
 
+static int dchu_hwmon_suspend(struct device *dev)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+
+    /* No firmware traffic while suspended; resume restarts what is needed */
+    cancel_delayed_work_sync(&ctx->curve_work);
+    cancel_delayed_work_sync(&ctx->sampler);
+    atomic_set(&ctx->sampling, 0);
+    dchu_flush_async(ctx->core);
+    return 0;
+}
+
+static void dchu_hwmon_restored(const struct dchu_async_req *req, int ret)
+{
+    struct dchu_hwmon_ctx *ctx = req->data;
+
+    if (ret) {
+        dev_warn(ctx->hwdev, "restoring _DSM %llu after resume failed: %d\n",
+                 req->function, ret);
+        return;
+    }
+    /* The curve engine takes over once the EC is back in custom mode */
+    if (req->function == 121) {
+        mutex_lock(&ctx->mode_lock);
+        dchu_curve_arm(ctx);
+        mutex_unlock(&ctx->mode_lock);
+    }
+}
+
+/*
+ * The EC may come back in auto mode. Queue the restore of the last mode
+ * (and manual duties) on the core's ordered workqueue rather than
+ * waiting for the firmware here, so resume is not held up.
+ */
+static int dchu_hwmon_resume(struct device *dev)
+{
+    struct dchu_hwmon_ctx *ctx = dev_get_drvdata(dev);
+    u8 payload[4];
+    int ret = 0;
+
+    mutex_lock(&ctx->lock);
+    ctx->valid = false;
+    mutex_unlock(&ctx->lock);
+
+    mutex_lock(&ctx->mode_lock);
+    if (ctx->mode_set) {
+        dchu_fan_mode_payload(payload, ctx->fan_mode);
+        ret = dchu_call_dsm_async(ctx->core, 121, payload, sizeof(payload),
+                                  dchu_hwmon_restored, ctx);
+    }
+    if (!ret && ctx->mode_set && ctx->manual) {
+        memset(payload, 0, sizeof(payload));
+        memcpy(payload, ctx->manual_duty, DCHU_NR_FANS);
+        ret = dchu_call_dsm_async(ctx->core, 104, payload, sizeof(payload),
+                                  dchu_hwmon_restored, ctx);
+    }
+    mutex_unlock(&ctx->mode_lock);
+    if (ret)
+        dev_warn(dev, "cannot queue fan restore: %d\n", ret);
+
+    dchu_hwmon_kick(ctx);
+    return 0;
+}
+
+static DEFINE_SIMPLE_DEV_PM_OPS(dchu_hwmon_pm, dchu_hwmon_suspend, dchu_hwmon_resume);
+
 static struct platform_driver dchu_hwmon_driver = {
     .driver = {
         .name = "dchu-hwmon",
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = pm_sleep_ptr(&dchu_hwmon_pm),
     },
     .probe = dchu_hwmon_probe,
     .remove = dchu_hwmon_remove,
@@ -377,6 +1848,7 @@ static struct platform_driver dchu_hwmon_driver = {
 
 module_platform_driver(dchu_hwmon_driver);
 
+MODULE_ALIAS("platform:dchu-hwmon");
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("hwmon driver for Insyde DCHU");
 MODULE_AUTHOR("stdpi <iam@stdpi.work>");
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/* FAN package decoding of dchu_hwmon, shared with dchu_kunit */
+#ifndef _DCHU_HWMON_H
+#define _DCHU_HWMON_H
+
+#include <linux/types.h>
+#include <linux/mod_devicetable.h>
+
+#define DCHU_NR_FANS     3
+#define DCHU_NR_TEMPS    3
+
+/* FAN package (_DSM 12) decoded once per refresh, in hwmon units */
+struct dchu_fan_pkg {
+    long rpm[DCHU_NR_FANS];     /* RPM */
+    long pwm[DCHU_NR_FANS];     /* 0..255 */
+    long temp[DCHU_NR_TEMPS];   /* m°C */
+    u32 alarms;                 /* DCHU_ALARM_* bits against the limits */
+};
+
+/* Per-model FAN package (_DSM 12) layout, picked by DMI at probe */
+struct dchu_layout {
+    const char *name;
+    u8 nr_fans;
+    u8 nr_temps;
+    u8 rpm_off[DCHU_NR_FANS];   /* first byte of the RPM/tach word */
+    u8 rpm_width;               /* 1 or 2 bytes */
+    bool le;                    /* word byte order, see dchu_get16() */
+    bool invert;                /* word is a tach period, not RPM */
+    u32 tach_hz;                /* tach base clock when inverted */
+    u32 ppr;                    /* pulses per revolution when inverted */
+    u8 duty_off[DCHU_NR_FANS];
+    u8 duty_max;                /* full-scale duty value */
+    u8 temp_off[DCHU_NR_TEMPS]; /* °C, one byte */
+    const char *fan_label[DCHU_NR_FANS];
+    const char *temp_label[DCHU_NR_TEMPS];
+};
+
+/* Module param overrides of the layout; -1 (invert, le) or 0 keeps it */
+struct dchu_decode_opts {
+    int invert;
+    int le;
+    u32 tach_hz;
+    u32 ppr;
+};
+
+#if IS_ENABLED(CONFIG_KUNIT)
+struct dchu;
+struct dchu_hwmon_ctx;
+struct device;
+
+/* Layouts by DMI match; driver_data is the struct dchu_layout */
+extern const struct dmi_system_id dchu_layout_dmi[];
+
+void dchu_decode_with(const struct dchu_layout *l, const struct dchu_decode_opts *o,
+                      const u8 *b, struct dchu_fan_pkg *pkg);
+long dchu_pwm_enable_get(struct dchu_hwmon_ctx *ctx);
+int dchu_pwm_enable_set(struct dchu_hwmon_ctx *ctx, long val);
+int dchu_fan_mode_set(struct dchu_hwmon_ctx *ctx, u8 mode);
+struct dchu_hwmon_ctx *dchu_hwmon_kunit_create(struct device *dev, struct dchu *core,
+                                               bool duty);
+#endif
+
+#endif /* _DCHU_HWMON_H */
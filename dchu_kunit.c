@@ -0,0 +1,344 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the DCHU drivers. The dchu_leds and dchu_hwmon paths
+ * run unchanged against the in-kernel mock firmware of dchu_core, minus
+ * the class device registration. See README "KUnit tests".
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/leds.h>
+#include <linux/swab.h>
+#include <kunit/test.h>
+#include <kunit/device.h>
+#include "dchu.h"
+#include "dchu_hwmon.h"
+
+struct dchu_test {
+    struct dchu *core;
+    struct device *dev;     /* owns the driver contexts */
+};
+
+static int dchu_test_init(struct kunit *test)
+{
+    struct dchu_test *t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, t);
+    t->core = dchu_mock_core_create();
+    KUNIT_ASSERT_NOT_NULL(test, t->core);
+    t->dev = kunit_device_register(test, "dchu-kunit");
+    if (IS_ERR(t->dev)) {
+        dchu_mock_core_destroy(t->core);
+        KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->dev);
+    }
+    test->priv = t;
+    return 0;
+}
+
+/* The contexts stop their work on the way out, before the core goes */
+static void dchu_test_exit(struct kunit *test)
+{
+    struct dchu_test *t = test->priv;
+
+    kunit_device_unregister(test, t->dev);
+    dchu_mock_core_destroy(t->core);
+}
+
+static u8 dchu_test_kbd_level(struct dchu *core)
+{
+    u8 level, mode;
+
+    dchu_mock_state(core, &level, &mode);
+    return level;
+}
+
+static u8 dchu_test_fan_mode(struct dchu *core)
+{
+    u8 level, mode;
+
+    dchu_mock_state(core, &level, &mode);
+    return mode;
+}
+
+/* brightness_set() reaches _DSM 39 from set_work; get answers from the cache */
+static void dchu_test_led_set_get(struct kunit *test)
+{
+    struct dchu_test *t = test->priv;
+    struct led_classdev *cdev = dchu_leds_kunit_create(t->dev, t->core);
+    int i;
+
+    KUNIT_ASSERT_NOT_NULL(test, cdev);
+    for (i = 0; i <= 5; i++) {
+        cdev->brightness_set(cdev, i);
+        dchu_leds_kunit_flush(cdev);
+        KUNIT_EXPECT_EQ(test, dchu_test_kbd_level(t->core), i);
+        KUNIT_EXPECT_EQ(test, cdev->brightness_get(cdev), i);
+    }
+
+    /* Above max_brightness is clamped, not passed on */
+    cdev->brightness_set(cdev, 9);
+    dchu_leds_kunit_flush(cdev);
+    KUNIT_EXPECT_EQ(test, dchu_test_kbd_level(t->core), 5);
+
+    /* Writes queued behind each other collapse to the last one */
+    cdev->brightness_set(cdev, 1);
+    cdev->brightness_set(cdev, 3);
+    dchu_leds_kunit_flush(cdev);
+    KUNIT_EXPECT_EQ(test, dchu_test_kbd_level(t->core), 3);
+    KUNIT_EXPECT_EQ(test, cdev->brightness_get(cdev), 3);
+}
+
+/* A level changed behind the driver shows up only after a resync */
+static void dchu_test_led_resync(struct kunit *test)
+{
+    struct dchu_test *t = test->priv;
+    struct led_classdev *cdev = dchu_leds_kunit_create(t->dev, t->core);
+    u8 set[4] = { 4 };
+
+    KUNIT_ASSERT_NOT_NULL(test, cdev);
+    cdev->brightness_set(cdev, 2);
+    dchu_leds_kunit_flush(cdev);
+    KUNIT_ASSERT_EQ(test, dchu_test_kbd_level(t->core), 2);
+
+    /* As the EC does on a backlight key */
+    KUNIT_ASSERT_EQ(test, dchu_call_dsm(t->core, 39, set, sizeof(set), NULL), 0);
+    KUNIT_EXPECT_EQ(test, cdev->brightness_get(cdev), 2);
+
+    KUNIT_EXPECT_EQ(test, dchu_led_resync(cdev), 0);
+    KUNIT_EXPECT_EQ(test, cdev->brightness, 4);
+    KUNIT_EXPECT_EQ(test, cdev->brightness_get(cdev), 4);
+
+    /* Once resynced, the old level is a change again and gets written */
+    set[0] = 0;
+    KUNIT_ASSERT_EQ(test, dchu_call_dsm(t->core, 39, set, sizeof(set), NULL), 0);
+    KUNIT_EXPECT_EQ(test, dchu_led_resync(cdev), 0);
+    KUNIT_EXPECT_EQ(test, cdev->brightness, 0);
+    cdev->brightness_set(cdev, 4);
+    dchu_leds_kunit_flush(cdev);
+    KUNIT_EXPECT_EQ(test, dchu_test_kbd_level(t->core), 4);
+}
+
+/* pwmN_enable 0 full, 2 EC auto; 1 and 3 write duties and need duty_control */
+static void dchu_test_pwm_enable(struct kunit *test)
+{
+    struct dchu_test *t = test->priv;
+    struct dchu_hwmon_ctx *ctx = dchu_hwmon_kunit_create(t->dev, t->core, false);
+
+    KUNIT_ASSERT_NOT_NULL(test, ctx);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 0), 0);
+    KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), DCHU_FAN_MODE_MAX);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_get(ctx), 0);
+
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 2), 0);
+    KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), DCHU_FAN_MODE_AUTO);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_get(ctx), 2);
+
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 1), -EOPNOTSUPP);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 3), -EOPNOTSUPP);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 4), -EINVAL);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, -1), -EINVAL);
+    KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), DCHU_FAN_MODE_AUTO);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_get(ctx), 2);
+}
+
+static void dchu_test_pwm_enable_duty(struct kunit *test)
+{
+    struct dchu_test *t = test->priv;
+    struct dchu_hwmon_ctx *ctx = dchu_hwmon_kunit_create(t->dev, t->core, true);
+
+    KUNIT_ASSERT_NOT_NULL(test, ctx);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 1), 0);
+    KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), DCHU_FAN_MODE_CUSTOM);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_get(ctx), 1);
+
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 3), 0);
+    KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), DCHU_FAN_MODE_CUSTOM);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_get(ctx), 3);
+
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 0), 0);
+    KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), DCHU_FAN_MODE_MAX);
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_get(ctx), 0);
+
+    /* Left in custom mode, teardown hands the fans back to the EC */
+    KUNIT_EXPECT_EQ(test, dchu_pwm_enable_set(ctx, 1), 0);
+    kunit_device_unregister(test, t->dev);
+    KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), DCHU_FAN_MODE_AUTO);
+    t->dev = kunit_device_register(test, "dchu-kunit");
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->dev);
+}
+
+/* The fan_mode store path; pwmN_enable reads the mode it leaves behind */
+static void dchu_test_fan_mode_set(struct kunit *test)
+{
+    static const u8 modes[] = {
+        DCHU_FAN_MODE_SILENT, DCHU_FAN_MODE_MAX, 5, 7, DCHU_FAN_MODE_AUTO,
+    };
+    static const long enable[] = { 2, 0, 2, 2, 2 };
+    struct dchu_test *t = test->priv;
+    struct dchu_hwmon_ctx *ctx = dchu_hwmon_kunit_create(t->dev, t->core, false);
+    int i;
+
+    KUNIT_ASSERT_NOT_NULL(test, ctx);
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+        KUNIT_EXPECT_EQ(test, dchu_fan_mode_set(ctx, modes[i]), 0);
+        KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), modes[i]);
+        KUNIT_EXPECT_EQ(test, dchu_pwm_enable_get(ctx), enable[i]);
+    }
+
+    KUNIT_EXPECT_EQ(test, dchu_fan_mode_set(ctx, 2), -ERANGE);
+    KUNIT_EXPECT_EQ(test, dchu_fan_mode_set(ctx, DCHU_FAN_MODE_CUSTOM), -EOPNOTSUPP);
+    KUNIT_EXPECT_EQ(test, dchu_test_fan_mode(t->core), DCHU_FAN_MODE_AUTO);
+}
+
+/* Store a fan word where the layout reads it, in its byte order */
+static void dchu_test_put_word(u8 *b, const struct dchu_layout *l, int fan, u16 v)
+{
+    u8 off = l->rpm_off[fan];
+
+    if (l->rpm_width == 1) {
+        b[off] = v;
+        return;
+    }
+    b[off] = l->le ? v >> 8 : v;
+    b[off + 1] = l->le ? v : v >> 8;
+}
+
+/*
+ * Every channel lands where the layout says: words through invert and
+ * tach_hz/ppr, duty scaled from duty_max, temps in m°C; channels the
+ * layout lacks stay 0. Then each override beats the layout.
+ */
+static void dchu_test_layout(struct kunit *test, const struct dchu_layout *l)
+{
+    const struct dchu_decode_opts keep = { .invert = -1, .le = -1 };
+    struct dchu_decode_opts o;
+    struct dchu_fan_pkg pkg;
+    u16 word[DCHU_NR_FANS];
+    u8 b[256] = { 0 };
+    int i;
+
+    kunit_info(test, "layout %s\n", l->name);
+    for (i = 0; i < l->nr_fans; i++) {
+        word[i] = l->rpm_width == 2 ? 0x0400 + 0x111 * i : 40 + i;
+        dchu_test_put_word(b, l, i, word[i]);
+        b[l->duty_off[i]] = l->duty_max / (i + 1);
+    }
+    for (i = 0; i < l->nr_temps; i++)
+        b[l->temp_off[i]] = 50 + i;
+
+    dchu_decode_with(l, &keep, b, &pkg);
+    for (i = 0; i < DCHU_NR_FANS; i++) {
+        if (i >= l->nr_fans) {
+            KUNIT_EXPECT_EQ(test, pkg.rpm[i], 0);
+            KUNIT_EXPECT_EQ(test, pkg.pwm[i], 0);
+            continue;
+        }
+        KUNIT_EXPECT_EQ(test, pkg.rpm[i],
+                        dchu_to_rpm(word[i], l->invert, l->tach_hz, l->ppr));
+        KUNIT_EXPECT_EQ(test, pkg.pwm[i],
+                        DIV_ROUND_CLOSEST(l->duty_max / (i + 1) * 255, l->duty_max));
+    }
+    KUNIT_EXPECT_EQ(test, pkg.pwm[0], 255);
+    for (i = 0; i < DCHU_NR_TEMPS; i++)
+        KUNIT_EXPECT_EQ(test, pkg.temp[i], i < l->nr_temps ? (50 + i) * 1000L : 0);
+
+    o = keep;
+    o.invert = !l->invert;
+    dchu_decode_with(l, &o, b, &pkg);
+    for (i = 0; i < l->nr_fans; i++)
+        KUNIT_EXPECT_EQ(test, pkg.rpm[i],
+                        dchu_to_rpm(word[i], !l->invert, l->tach_hz, l->ppr));
+
+    o = keep;
+    o.invert = 1;
+    o.tach_hz = 1000000;
+    o.ppr = 2;
+    dchu_decode_with(l, &o, b, &pkg);
+    for (i = 0; i < l->nr_fans; i++)
+        KUNIT_EXPECT_EQ(test, pkg.rpm[i], dchu_to_rpm(word[i], true, 1000000, 2));
+
+    if (l->rpm_width == 2) {
+        o = keep;
+        o.invert = 0;
+        o.le = !l->le;
+        dchu_decode_with(l, &o, b, &pkg);
+        for (i = 0; i < l->nr_fans; i++)
+            KUNIT_EXPECT_EQ(test, pkg.rpm[i], (long)swab16(word[i]));
+    }
+}
+
+static void dchu_test_layouts(struct kunit *test)
+{
+    const struct dmi_system_id *id;
+
+    for (id = dchu_layout_dmi; id->driver_data; id++)
+        dchu_test_layout(test, id->driver_data);
+}
+
+/* Known U4 UD numbers: 2000 RPM off the 35940 Hz tach, 40% duty, 55 °C */
+static void dchu_test_u4ud(struct kunit *test)
+{
+    static const u8 b[32] = {
+        [2] = 0x04, [3] = 0x36, [16] = 40, [18] = 55,
+    };
+    const struct dchu_decode_opts keep = { .invert = -1, .le = -1 };
+    const struct dchu_layout *l = dchu_layout_dmi[0].driver_data;
+    struct dchu_fan_pkg pkg;
+
+    KUNIT_ASSERT_STREQ(test, l->name, "Gigabyte U4 UD");
+    dchu_decode_with(l, &keep, b, &pkg);
+    KUNIT_EXPECT_EQ(test, pkg.rpm[0], 2000);
+    KUNIT_EXPECT_EQ(test, pkg.pwm[0], 102);
+    KUNIT_EXPECT_EQ(test, pkg.temp[0], 55000);
+    KUNIT_EXPECT_EQ(test, pkg.rpm[1], 0);
+}
+
+static struct kunit_case dchu_decode_cases[] = {
+    KUNIT_CASE(dchu_test_layouts),
+    KUNIT_CASE(dchu_test_u4ud),
+    {}
+};
+
+static struct kunit_suite dchu_decode_suite = {
+    .name = "dchu_decode",
+    .test_cases = dchu_decode_cases,
+};
+
+static struct kunit_case dchu_leds_cases[] = {
+    KUNIT_CASE(dchu_test_led_set_get),
+    KUNIT_CASE(dchu_test_led_resync),
+    {}
+};
+
+static struct kunit_suite dchu_leds_suite = {
+    .name = "dchu_leds",
+    .init = dchu_test_init,
+    .exit = dchu_test_exit,
+    .test_cases = dchu_leds_cases,
+};
+
+static struct kunit_case dchu_hwmon_cases[] = {
+    KUNIT_CASE(dchu_test_pwm_enable),
+    KUNIT_CASE(dchu_test_pwm_enable_duty),
+    KUNIT_CASE(dchu_test_fan_mode_set),
+    {}
+};
+
+static struct kunit_suite dchu_hwmon_suite = {
+    .name = "dchu_hwmon",
+    .init = dchu_test_init,
+    .exit = dchu_test_exit,
+    .test_cases = dchu_hwmon_cases,
+};
+
+kunit_test_suites(&dchu_decode_suite, &dchu_leds_suite, &dchu_hwmon_suite);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+MODULE_IMPORT_NS("EXPORTED_FOR_KUNIT_TESTING");
+#else
+MODULE_IMPORT_NS(EXPORTED_FOR_KUNIT_TESTING);
+#endif
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit tests for the Insyde DCHU drivers");
+MODULE_AUTHOR("stdpi <iam@stdpi.work>");
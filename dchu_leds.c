@@ -6,102 +6,332 @@
 #include <linux/leds.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/pm.h>
+#include <kunit/visibility.h>
 #include "dchu.h"
 
 struct dchu_leds_ctx {
     struct dchu *core;
+    struct device *dev;         /* our platform device, outlives cdev.dev */
     struct led_classdev cdev;
     struct mutex lock;
     u8 last_level;
+    bool level_valid;           /* last_level matches the firmware */
+    struct work_struct set_work;    /* sends want; latest write wins */
+    int want;
+    struct delayed_work pattern_work;   /* steps the hw_pattern below */
+    struct led_pattern *pattern;
+    u32 pattern_len;
+    int repeat;                 /* repetitions left, -1 = forever */
+    u32 pat_idx;                /* current entry */
+    u32 pat_step;               /* level step within the entry */
+    struct notifier_block nb;   /* EC events from dchu_core */
+    int resume_level;           /* level to restore, -1 if never known */
 };
 
 static enum led_brightness dchu_led_get(struct led_classdev *cdev)
 {
     struct dchu_leds_ctx *ctx = container_of(cdev, struct dchu_leds_ctx, cdev);
-    union acpi_object *obj = NULL;
+    struct dchu_dsm_res res = { 0 };
+    u8 payload[1] = { 0 };
     int ret;
     enum led_brightness b = 0;
 
     mutex_lock(&ctx->lock);
-    u8 payload[1] = { 0 };
-    ret = dchu_call_dsm(ctx->core, 61, payload, sizeof(payload), &obj);
-    if (!ret && obj && obj->type == ACPI_TYPE_INTEGER) {
-        u64 v = obj->integer.value & 0xff; /* 1 byte casted to int */
+    /*
+     * Our own writes keep the cache valid; only resync asks the firmware,
+     * and only when it has a GET function at all.
+     */
+    if (ctx->level_valid || !dchu_has_func(ctx->core, 61)) {
+        b = ctx->last_level;
+        mutex_unlock(&ctx->lock);
+        return b;
+    }
+    ret = dchu_query_dsm(ctx->core, 61, payload, sizeof(payload), &res);
+    if (!ret && res.type == ACPI_TYPE_INTEGER) {
+        u64 v = res.integer & 0xff; /* 1 byte casted to int */
         if (v > cdev->max_brightness)
             v = cdev->max_brightness;
         b = (enum led_brightness)v;
+        ctx->last_level = b;
+        ctx->level_valid = true;
     } else {
-        /* Fallback to last set value if GET is unsupported */
+        /* Transient failure: keep the last known level */
         b = ctx->last_level;
     }
-    kfree(obj);
     mutex_unlock(&ctx->lock);
     return b;
 }
 
-static int dchu_led_set(struct led_classdev *cdev, enum led_brightness value)
+static int dchu_led_write_locked(struct dchu_leds_ctx *ctx, enum led_brightness value)
 {
-    struct dchu_leds_ctx *ctx = container_of(cdev, struct dchu_leds_ctx, cdev);
     u8 payload[4] = { 0, 0, 0, 0 };
     int ret;
 
-    if (value > cdev->max_brightness)
-        value = cdev->max_brightness;
+    lockdep_assert_held(&ctx->lock);
+    if (value > ctx->cdev.max_brightness)
+        value = ctx->cdev.max_brightness;
 
     payload[0] = (u8)value; /* 0..5 */
 
-    mutex_lock(&ctx->lock);
     ret = dchu_call_dsm(ctx->core, 39, payload, sizeof(payload), NULL);
-    mutex_unlock(&ctx->lock);
-    if (!ret)
+    if (!ret) {
         ctx->last_level = payload[0];
+        ctx->level_valid = true;
+    }
+    return ret;
+}
+
+static int dchu_led_write(struct dchu_leds_ctx *ctx, enum led_brightness value)
+{
+    int ret;
+
+    mutex_lock(&ctx->lock);
+    ret = dchu_led_write_locked(ctx, value);
+    mutex_unlock(&ctx->lock);
     return ret;
 }
 
-/* Debug helpers on parent platform device for raw access */
-static ssize_t raw_status_show(struct device *dev,
-                               struct device_attribute *attr, char *buf)
+static void dchu_led_set_work(struct work_struct *work)
 {
-    struct dchu_leds_ctx *ctx = platform_get_drvdata(to_platform_device(dev));
-    union acpi_object *obj = NULL; int ret; ssize_t n = 0; u32 i;
+    struct dchu_leds_ctx *ctx = container_of(work, struct dchu_leds_ctx, set_work);
+    int level = READ_ONCE(ctx->want);
+    int ret = 0;
+
+    mutex_lock(&ctx->lock);
+    if (!ctx->level_valid || level != ctx->last_level)
+        ret = dchu_led_write_locked(ctx, level);
+    mutex_unlock(&ctx->lock);
+    if (ret)
+        dev_warn_ratelimited(ctx->dev, "set level %d failed\n", level);
+}
+
+/* Never waits on firmware; writes landing while one is in flight collapse */
+static void dchu_led_set(struct led_classdev *cdev, enum led_brightness value)
+{
+    struct dchu_leds_ctx *ctx = container_of(cdev, struct dchu_leds_ctx, cdev);
+
+    WRITE_ONCE(ctx->want, min_t(int, value, cdev->max_brightness));
+    queue_work(system_unbound_wq, &ctx->set_work);
+}
+
+/* Drop the cached level and read it back from _DSM 61 */
+VISIBLE_IF_KUNIT int dchu_led_resync(struct led_classdev *cdev)
+{
+    struct dchu_leds_ctx *ctx = container_of(cdev, struct dchu_leds_ctx, cdev);
+
     mutex_lock(&ctx->lock);
-    ret = dchu_call_dsm(ctx->core, 61, NULL, 0, &obj);
-    if (!ret && obj) {
-        if (obj->type == ACPI_TYPE_INTEGER) {
-            n = scnprintf(buf, PAGE_SIZE, "int %llu\n", obj->integer.value);
-        } else if (obj->type == ACPI_TYPE_BUFFER) {
-            n += scnprintf(buf + n, PAGE_SIZE - n, "buf %u ", obj->buffer.length);
-            for (i = 0; i < obj->buffer.length && n < PAGE_SIZE - 4; i++)
-                n += scnprintf(buf + n, PAGE_SIZE - n, "%02x%s",
-                               obj->buffer.pointer[i], i + 1 < obj->buffer.length ? " " : "\n");
-        } else {
-            n = scnprintf(buf, PAGE_SIZE, "type %d\n", obj->type);
+    ctx->level_valid = false;
+    mutex_unlock(&ctx->lock);
+    return led_update_brightness(cdev);
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_led_resync);
+
+/* Writing 1 resyncs */
+static ssize_t resync_store(struct device *dev,
+                            struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct led_classdev *cdev = dev_get_drvdata(dev);
+    bool v;
+    int ret;
+
+    ret = kstrtobool(buf, &v);
+    if (ret)
+        return ret;
+    if (v)
+        dchu_led_resync(cdev);
+    return count;
+}
+static DEVICE_ATTR_WO(resync);
+
+static struct attribute *dchu_led_attrs[] = {
+    &dev_attr_resync.attr,
+    NULL,
+};
+
+/* resync has nothing to read back without _DSM 61 */
+static umode_t dchu_led_attr_visible(struct kobject *kobj, struct attribute *attr, int n)
+{
+    struct led_classdev *cdev = dev_get_drvdata(kobj_to_dev(kobj));
+    struct dchu_leds_ctx *ctx = container_of(cdev, struct dchu_leds_ctx, cdev);
+
+    return dchu_has_func(ctx->core, 61) ? attr->mode : 0;
+}
+
+static const struct attribute_group dchu_led_group = {
+    .attrs = dchu_led_attrs,
+    .is_visible = dchu_led_attr_visible,
+};
+__ATTRIBUTE_GROUPS(dchu_led);
+
+static int dchu_led_level(struct dchu_leds_ctx *ctx, int brightness)
+{
+    return clamp_t(int, brightness, 0, ctx->cdev.max_brightness);
+}
+
+/*
+ * hw_pattern player. Like the software pattern trigger, brightness moves
+ * linearly from each entry to the next over the entry's delta_t, but with
+ * only six levels that is a handful of discrete steps, so the work runs
+ * once per level change instead of on a fixed tick.
+ */
+static void dchu_led_pattern_work(struct work_struct *work)
+{
+    struct dchu_leds_ctx *ctx = container_of(to_delayed_work(work),
+                                             struct dchu_leds_ctx, pattern_work);
+    const struct led_pattern *p = &ctx->pattern[ctx->pat_idx];
+    const struct led_pattern *next = &ctx->pattern[(ctx->pat_idx + 1) % ctx->pattern_len];
+    int from = dchu_led_level(ctx, p->brightness);
+    int to = dchu_led_level(ctx, next->brightness);
+    u32 steps = max(abs(to - from), 1);
+    int level = from + (to > from ? 1 : -1) * (int)ctx->pat_step;
+
+    if (from == to)
+        level = from;
+    if (level != ctx->last_level)
+        dchu_led_write(ctx, level);
+
+    if (++ctx->pat_step >= steps) {
+        ctx->pat_step = 0;
+        if (++ctx->pat_idx == ctx->pattern_len) {
+            ctx->pat_idx = 0;
+            /* Done: settle on the last entry, as the software trigger does */
+            if (ctx->repeat > 0 && --ctx->repeat == 0) {
+                dchu_led_write(ctx, dchu_led_level(ctx, p->brightness));
+                return;
+            }
         }
-    } else {
-        n = scnprintf(buf, PAGE_SIZE, "err %d\n", ret);
     }
-    kfree(obj);
-    mutex_unlock(&ctx->lock);
-    return n;
+    queue_delayed_work(system_unbound_wq, &ctx->pattern_work,
+                       msecs_to_jiffies(p->delta_t / steps));
+}
+
+/* Also reached on unregister, when the classdev drops its trigger */
+static int dchu_led_pattern_clear(struct led_classdev *cdev)
+{
+    struct dchu_leds_ctx *ctx = container_of(cdev, struct dchu_leds_ctx, cdev);
+
+    cancel_delayed_work_sync(&ctx->pattern_work);
+    kfree(ctx->pattern);
+    ctx->pattern = NULL;
+    ctx->pattern_len = 0;
+    return 0;
 }
-static DEVICE_ATTR_RO(raw_status);
 
-static ssize_t raw_set_store(struct device *dev,
-                             struct device_attribute *attr, const char *buf, size_t count)
+static int dchu_led_pattern_set(struct led_classdev *cdev,
+                                struct led_pattern *pattern, u32 len, int repeat)
 {
-    struct dchu_leds_ctx *ctx = platform_get_drvdata(to_platform_device(dev));
-    unsigned long v; int ret; u8 payload[4] = {0};
-    if (kstrtoul(buf, 0, &v))
+    struct dchu_leds_ctx *ctx = container_of(cdev, struct dchu_leds_ctx, cdev);
+    struct led_pattern *copy;
+    u64 total = 0;
+    u32 i;
+
+    if (!len || !repeat)
+        return -EINVAL;
+    for (i = 0; i < len; i++)
+        total += pattern[i].delta_t;
+    /* An all-zero pattern would spin the worker */
+    if (!total)
         return -EINVAL;
-    if (v > 255)
-        v = 255;
-    payload[0] = (u8)v;
+
+    copy = kmemdup_array(pattern, len, sizeof(*pattern), GFP_KERNEL);
+    if (!copy)
+        return -ENOMEM;
+
+    dchu_led_pattern_clear(cdev);
+    ctx->pattern = copy;
+    ctx->pattern_len = len;
+    ctx->repeat = repeat;
+    ctx->pat_idx = 0;
+    ctx->pat_step = 0;
+    queue_delayed_work(system_unbound_wq, &ctx->pattern_work, 0);
+    return 0;
+}
+
+/* The EC moved the backlight itself (Fn keys): re-read and tell userspace */
+static int dchu_leds_event(struct notifier_block *nb, unsigned long code, void *data)
+{
+    struct dchu_leds_ctx *ctx = container_of(nb, struct dchu_leds_ctx, nb);
+    enum led_brightness level;
+
+    if (!dchu_event_kbd_light(code))
+        return NOTIFY_DONE;
+
     mutex_lock(&ctx->lock);
-    ret = dchu_call_dsm(ctx->core, 31, payload, sizeof(payload), NULL);
+    ctx->level_valid = false;
     mutex_unlock(&ctx->lock);
-    return ret ? ret : count;
+    level = dchu_led_get(&ctx->cdev);
+    ctx->cdev.brightness = level;
+    led_classdev_notify_brightness_hw_changed(&ctx->cdev, level);
+    sysfs_notify(&ctx->cdev.dev->kobj, NULL, "brightness");
+    return NOTIFY_OK;
+}
+
+static void dchu_leds_unnotify(void *data)
+{
+    struct dchu_leds_ctx *ctx = data;
+
+    dchu_unregister_notifier(ctx->core, &ctx->nb);
+}
+
+static void dchu_leds_stop(void *data)
+{
+    struct dchu_leds_ctx *ctx = data;
+
+    /* Lets the final LED_OFF from unregister reach the firmware */
+    flush_work(&ctx->set_work);
+}
+
+/* Context and classdev short of registration; shared with the KUnit hook */
+static void dchu_leds_setup(struct dchu_leds_ctx *ctx, struct dchu *core,
+                            struct device *dev)
+{
+    ctx->core = core;
+    ctx->dev = dev;
+    mutex_init(&ctx->lock);
+    INIT_DELAYED_WORK(&ctx->pattern_work, dchu_led_pattern_work);
+    INIT_WORK(&ctx->set_work, dchu_led_set_work);
+
+    ctx->cdev.name = "dchu::kbd_backlight";
+    ctx->cdev.max_brightness = 5;
+    ctx->cdev.brightness_set = dchu_led_set;
+    ctx->cdev.brightness_get = dchu_led_get;
+    ctx->cdev.pattern_set = dchu_led_pattern_set;
+    ctx->cdev.pattern_clear = dchu_led_pattern_clear;
+    ctx->cdev.groups = dchu_led_groups;
+    ctx->cdev.flags = LED_BRIGHT_HW_CHANGED;
+    ctx->last_level = 0;
 }
-static DEVICE_ATTR_WO(raw_set);
+
+#if IS_ENABLED(CONFIG_KUNIT)
+/*
+ * The classdev probe would register, left unregistered, on core; its
+ * pending write is flushed when dev goes away. For dchu_kunit.
+ */
+struct led_classdev *dchu_leds_kunit_create(struct device *dev, struct dchu *core)
+{
+    struct dchu_leds_ctx *ctx;
+
+    ctx = devm_kzalloc(dev, sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return NULL;
+    dchu_leds_setup(ctx, core, dev);
+    if (devm_add_action_or_reset(dev, dchu_leds_stop, ctx))
+        return NULL;
+    return &ctx->cdev;
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_leds_kunit_create);
+
+/* Wait for brightness_set() to reach the firmware */
+void dchu_leds_kunit_flush(struct led_classdev *cdev)
+{
+    struct dchu_leds_ctx *ctx = container_of(cdev, struct dchu_leds_ctx, cdev);
+
+    flush_work(&ctx->set_work);
+}
+EXPORT_SYMBOL_IF_KUNIT(dchu_leds_kunit_flush);
+#endif
 
 static int dchu_leds_probe(struct platform_device *pdev)
 {
@@ -112,44 +342,78 @@ static int dchu_leds_probe(struct platform_device *pdev)
     if (!pdata || !pdata->core)
         return -ENODEV;
 
+    if (!dchu_has_func(pdata->core, 39)) {
+        dev_info(&pdev->dev, "firmware has no backlight control (_DSM 39)\n");
+        return -ENODEV;
+    }
     ctx = devm_kzalloc(&pdev->dev, sizeof(*ctx), GFP_KERNEL);
     if (!ctx)
         return -ENOMEM;
-    ctx->core = pdata->core;
-    mutex_init(&ctx->lock);
+    dchu_leds_setup(ctx, pdata->core, &pdev->dev);
 
-    ctx->cdev.name = "dchu::kbd_backlight";
-    ctx->cdev.max_brightness = 5;
-    ctx->cdev.brightness_set_blocking = dchu_led_set;
-    ctx->cdev.brightness_get = dchu_led_get;
-    ctx->last_level = 0;
+    /* Registered before the classdev so it runs after unregister */
+    ret = devm_add_action(&pdev->dev, dchu_leds_stop, ctx);
+    if (ret)
+        return ret;
 
     ret = devm_led_classdev_register(&pdev->dev, &ctx->cdev);
     if (ret)
         return ret;
 
-    /* Register debug attrs on platform device */
-    ret = device_create_file(&pdev->dev, &dev_attr_raw_status);
+    ctx->nb.notifier_call = dchu_leds_event;
+    ret = dchu_register_notifier(ctx->core, &ctx->nb);
     if (ret)
         return ret;
-    ret = device_create_file(&pdev->dev, &dev_attr_raw_set);
+    ret = devm_add_action_or_reset(&pdev->dev, dchu_leds_unnotify, ctx);
     if (ret)
         return ret;
 
     platform_set_drvdata(pdev, ctx);
+    device_enable_async_suspend(&pdev->dev);
     dev_info(&pdev->dev, "dchu-leds initialized\n");
     return 0;
 }
 
-static void dchu_leds_remove(struct platform_device *pdev)
+static void dchu_leds_remove(struct platform_device *pdev) { }
+
+static int dchu_leds_suspend(struct device *dev)
 {
-    device_remove_file(&pdev->dev, &dev_attr_raw_status);
-    device_remove_file(&pdev->dev, &dev_attr_raw_set);
+    struct dchu_leds_ctx *ctx = dev_get_drvdata(dev);
+
+    /* Let queued writes land, then stop talking to the firmware */
+    cancel_delayed_work_sync(&ctx->pattern_work);
+    flush_work(&ctx->set_work);
+    mutex_lock(&ctx->lock);
+    ctx->resume_level = ctx->level_valid ? ctx->last_level : -1;
+    mutex_unlock(&ctx->lock);
+    return 0;
 }
 
+/* The EC may resume with the backlight off; restore it from the work item */
+static int dchu_leds_resume(struct device *dev)
+{
+    struct dchu_leds_ctx *ctx = dev_get_drvdata(dev);
+
+    mutex_lock(&ctx->lock);
+    ctx->level_valid = false;
+    mutex_unlock(&ctx->lock);
+
+    if (ctx->resume_level >= 0) {
+        WRITE_ONCE(ctx->want, ctx->resume_level);
+        queue_work(system_unbound_wq, &ctx->set_work);
+    }
+    if (ctx->pattern)
+        queue_delayed_work(system_unbound_wq, &ctx->pattern_work, 0);
+    return 0;
+}
+
+static DEFINE_SIMPLE_DEV_PM_OPS(dchu_leds_pm, dchu_leds_suspend, dchu_leds_resume);
+
 static struct platform_driver dchu_leds_driver = {
     .driver = {
         .name = "dchu-leds",
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = pm_sleep_ptr(&dchu_leds_pm),
     },
     .probe = dchu_leds_probe,
     .remove = dchu_leds_remove,
@@ -157,6 +421,7 @@ static struct platform_driver dchu_leds_driver = {
 
 module_platform_driver(dchu_leds_driver);
 
+MODULE_ALIAS("platform:dchu-leds");
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Insyde DCHU keyboard light");
 MODULE_AUTHOR("stdpi <iam@stdpi.work>");
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dchu
+
+#if !defined(_DCHU_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DCHU_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(dchu_dsm_enter,
+    TP_PROTO(u64 function, u32 payload_len),
+    TP_ARGS(function, payload_len),
+    TP_STRUCT__entry(
+        __field(u64, function)
+        __field(u32, payload_len)
+    ),
+    TP_fast_assign(
+        __entry->function = function;
+        __entry->payload_len = payload_len;
+    ),
+    TP_printk("function=%llu len=%u", __entry->function, __entry->payload_len)
+);
+
+TRACE_EVENT(dchu_dsm_exit,
+    TP_PROTO(u64 function, u32 payload_len, int status, u64 duration_ns, u64 smi),
+    TP_ARGS(function, payload_len, status, duration_ns, smi),
+    TP_STRUCT__entry(
+        __field(u64, function)
+        __field(u32, payload_len)
+        __field(int, status)
+        __field(u64, duration_ns)
+        __field(u64, smi)
+    ),
+    TP_fast_assign(
+        __entry->function = function;
+        __entry->payload_len = payload_len;
+        __entry->status = status;
+        __entry->duration_ns = duration_ns;
+        __entry->smi = smi;
+    ),
+    TP_printk("function=%llu len=%u status=%d duration_ns=%llu smi=%llu",
+              __entry->function, __entry->payload_len, __entry->status,
+              __entry->duration_ns, __entry->smi)
+);
+
+#endif /* _DCHU_TRACE_H */
+
+/* Out-of-tree module: the header sits next to dchu_core.c (-I$(src)) */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dchu_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+#ifndef _DCHU_UAPI_H
+#define _DCHU_UAPI_H
+
+/*
+ * Userspace ABI of /dev/dchu (dchu_chardev.ko).
+ *
+ * The device is a read-only telemetry ring. mmap() it at offset 0 to get a
+ * struct dchu_ring_hdr followed by hdr.nr_entries struct dchu_sample slots
+ * starting at hdr.data_offset. While at least one file is open the driver
+ * samples the FAN package (_DSM 12) at the rate_hz module parameter.
+ *
+ * hdr.head counts samples ever written; sample n lives in slot
+ * n % nr_entries and carries seq == n once complete. Read head with
+ * acquire semantics, copy the slot and re-check seq to detect overwrites.
+ * poll() reports EPOLLIN while head is past the position the reader last
+ * passed to DCHU_IOC_ACK (the head at open() until then), so ack the head
+ * you have consumed before polling again. EPOLLHUP | EPOLLERR means the
+ * device went away; no more samples will come.
+ *
+ * DCHU_IOC_RAW_BATCH (CAP_SYS_RAWIO only, works on the read-only fd)
+ * evaluates up to DCHU_RAW_BATCH_MAX arbitrary {function, payload} _DSM
+ * calls in one syscall, back to back under the core lock in chunks of
+ * 16. Every entry reports its own status, typed result and firmware time;
+ * the ioctl itself only fails for a malformed batch.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define DCHU_RING_MAGIC     0x55484344  /* "DCHU" */
+#define DCHU_RING_VERSION   1
+#define DCHU_SAMPLE_RAW     32          /* FAN package bytes kept per sample */
+
+struct dchu_ring_hdr {
+    __u32 magic;
+    __u32 version;
+    __u32 entry_size;   /* sizeof(struct dchu_sample) */
+    __u32 nr_entries;   /* power of two */
+    __u32 data_offset;  /* offset of slot 0 from the start of the mapping */
+    __u32 period_us;    /* sampling period at the time of the last sample */
+    __u64 head;         /* samples written so far */
+};
+
+struct dchu_sample {
+    __u64 seq;          /* sample number, ~0 while the slot is being written */
+    __u64 time_ns;      /* CLOCK_MONOTONIC */
+    __s32 status;       /* 0 or -errno of the _DSM 12 evaluation */
+    __u16 len;          /* valid bytes in raw */
+    __u16 reserved;
+    __u8 raw[DCHU_SAMPLE_RAW];  /* RPM words, duties, temps; see README */
+};
+
+#define DCHU_RAW_PAYLOAD_MAX  64
+#define DCHU_RAW_BUF_MAX      256
+#define DCHU_RAW_BATCH_MAX    1024
+
+/* Result types in dchu_raw_call.type, as ACPI_TYPE_* */
+#define DCHU_RAW_INTEGER      1
+#define DCHU_RAW_BUFFER       3
+#define DCHU_RAW_PACKAGE      4
+
+struct dchu_raw_call {
+    __u64 function;             /* in: _DSM function id */
+    __u32 payload_len;          /* in: <= DCHU_RAW_PAYLOAD_MAX, 0 = no payload */
+    __u32 flags;                /* in: must be 0 */
+    __u8 payload[DCHU_RAW_PAYLOAD_MAX];
+    __s32 status;               /* out: 0 or -errno of this evaluation */
+    __u32 type;                 /* out: DCHU_RAW_*, other ACPI types as is */
+    __u64 integer;              /* out: DCHU_RAW_INTEGER value */
+    __u32 len;                  /* out: buffer bytes or package count, may exceed buf */
+    __u32 reserved;
+    __u64 duration_ns;          /* out: time spent in the firmware */
+    __u8 buf[DCHU_RAW_BUF_MAX]; /* out: DCHU_RAW_BUFFER bytes */
+};
+
+struct dchu_raw_batch {
+    __u32 nr;                   /* entries at calls, 1..DCHU_RAW_BATCH_MAX */
+    __u32 flags;                /* must be 0 */
+    __u64 calls;                /* user pointer to struct dchu_raw_call[nr] */
+};
+
+#define DCHU_IOC_MAGIC        'D'
+#define DCHU_IOC_RAW_BATCH    _IOWR(DCHU_IOC_MAGIC, 1, struct dchu_raw_batch)
+#define DCHU_IOC_ACK          _IOW(DCHU_IOC_MAGIC, 2, __u64)    /* consumed head */
+
+#endif /* _DCHU_UAPI_H */
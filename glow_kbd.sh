@@ -1,6 +1,10 @@
 #!/usr/bin/env bash
 # Glowing animation for DCHU keyboard backlight LED
 # Default LED: /sys/class/leds/dchu::kbd_backlight (max_brightness=5)
+#
+# When the LED offers the "pattern" trigger the effect is programmed once
+# into hw_pattern and runs in the driver; this script then exits. The shell
+# loop below is only a fallback (or forced with -l).
 
 set -euo pipefail
 
@@ -9,15 +13,19 @@ LED_PATH="${LED_DEFAULT}"
 DELAY="0.08"       # seconds between steps
 CYCLES="-1"        # -1 = infinite, otherwise number of up+down cycles
 MAX_OVERRIDE=""    # override max_brightness
+LEGACY=0           # 1 = always use the shell loop
 
 usage() {
   cat <<EOF
-Usage: $(basename "$0") [-d LED_PATH] [-s STEP_DELAY] [-c CYCLES] [-m MAX]
+Usage: $(basename "$0") [-d LED_PATH] [-s STEP_DELAY] [-c CYCLES] [-m MAX] [-l]
 
   -d LED_PATH   LED sysfs path (default: ${LED_DEFAULT})
   -s DELAY      Step delay in seconds (default: ${DELAY})
   -c CYCLES     Number of glow cycles; -1 = infinite (default: ${CYCLES})
   -m MAX        Override max_brightness (default: read from sysfs)
+  -l            Animate from this shell instead of the in-kernel pattern trigger
+
+Stop an in-kernel effect with: echo none > LED_PATH/trigger
 
 Examples:
   sudo $(basename "$0")
@@ -26,12 +34,13 @@ Examples:
 EOF
 }
 
-while getopts ":d:s:c:m:h" opt; do
+while getopts ":d:s:c:m:lh" opt; do
   case "$opt" in
     d) LED_PATH="$OPTARG" ;;
     s) DELAY="$OPTARG" ;;
     c) CYCLES="$OPTARG" ;;
     m) MAX_OVERRIDE="$OPTARG" ;;
+    l) LEGACY=1 ;;
     h) usage; exit 0 ;;
     :) echo "Missing value for -$OPTARG" >&2; usage; exit 2 ;;
     \?) echo "Unknown option: -$OPTARG" >&2; usage; exit 2 ;;
@@ -80,6 +89,23 @@ if ! [[ "$CYCLES" =~ ^-?[0-9]+$ ]]; then
   exit 2
 fi
 
+# In-kernel path: ramp 0..MAX..0 with the same per-step timing
+TRIG="$LED_PATH/trigger"
+if [ "$LEGACY" -eq 0 ] && [ -f "$TRIG" ] && grep -qw pattern "$TRIG"; then
+  RAMP_MS=$(awk -v d="$DELAY" -v m="$MAX" 'BEGIN { printf "%d", d * m * 1000 }')
+  REPEAT="$CYCLES"
+  sysfs_write() {
+    if ! echo "$2" > "$1" 2>/dev/null; then
+      echo "$2" | sudo tee "$1" >/dev/null
+    fi
+  }
+  sysfs_write "$TRIG" pattern
+  sysfs_write "$LED_PATH/repeat" "$REPEAT"
+  sysfs_write "$LED_PATH/hw_pattern" "0 $RAMP_MS $MAX $RAMP_MS"
+  echo "Pattern running in the driver; stop with: echo none > $TRIG"
+  exit 0
+fi
+
 write_brightness() {
   local v="$1"
   # Try direct write; if it fails, attempt sudo tee
@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * dchu-bench: sensor read latency/throughput benchmark for dchu hwmon.
+ *
+ * Reads fan*_input, pwmN and temp*_input of a hwmon directory in a loop,
+ * optionally from several threads at once, and prints one JSON object
+ * with latency percentiles and reads/sec. Any directory laid out like
+ * hwmon works, so a fake tree can be used for offline runs.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ATTRS 64
+
+struct bench {
+    char dir[PATH_MAX];
+    char *attrs[MAX_ATTRS];
+    char *paths[MAX_ATTRS];
+    int nattrs;
+    long iters;        /* passes over all attributes, per thread */
+    int threads;
+    int keep_open;     /* pread() on cached fds instead of open/read/close */
+};
+
+struct worker {
+    pthread_t tid;
+    struct bench *b;
+    uint64_t *lat;     /* ns, one per read */
+    long nlat;
+    long errors;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int is_sensor(const char *name)
+{
+    return !fnmatch("fan[0-9]*_input", name, 0) ||
+           !fnmatch("temp[0-9]*_input", name, 0) ||
+           (!fnmatch("pwm[0-9]*", name, 0) && !strchr(name, '_'));
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* First /sys/class/hwmon/hwmonX whose name is "dchu" */
+static int find_dchu(char *out, size_t len)
+{
+    const char *base = "/sys/class/hwmon";
+    struct dirent *de;
+    char path[PATH_MAX], name[64];
+    DIR *d;
+    FILE *f;
+    int found = 0;
+
+    d = opendir(base);
+    if (!d)
+        return -1;
+    while (!found && (de = readdir(d))) {
+        if (strncmp(de->d_name, "hwmon", 5))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s/name", base, de->d_name);
+        f = fopen(path, "r");
+        if (!f)
+            continue;
+        if (fgets(name, sizeof(name), f) && !strcmp(name, "dchu\n")) {
+            snprintf(out, len, "%s/%s", base, de->d_name);
+            found = 1;
+        }
+        fclose(f);
+    }
+    closedir(d);
+    return found ? 0 : -1;
+}
+
+static int scan_attrs(struct bench *b)
+{
+    struct dirent *de;
+    DIR *d;
+    int i;
+
+    d = opendir(b->dir);
+    if (!d)
+        return -1;
+    while ((de = readdir(d)) && b->nattrs < MAX_ATTRS)
+        if (is_sensor(de->d_name))
+            b->attrs[b->nattrs++] = strdup(de->d_name);
+    closedir(d);
+    qsort(b->attrs, b->nattrs, sizeof(b->attrs[0]), cmp_str);
+    for (i = 0; i < b->nattrs; i++)
+        if (asprintf(&b->paths[i], "%s/%s", b->dir, b->attrs[i]) < 0)
+            return -1;
+    return b->nattrs ? 0 : -1;
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    struct bench *b = w->b;
+    int fds[MAX_ATTRS];
+    char buf[64];
+    uint64_t t0;
+    long i;
+    int a, fd;
+    ssize_t n;
+
+    for (a = 0; a < b->nattrs; a++) {
+        fds[a] = -1;
+        if (b->keep_open)
+            fds[a] = open(b->paths[a], O_RDONLY);
+    }
+
+    for (i = 0; i < b->iters; i++) {
+        for (a = 0; a < b->nattrs; a++) {
+            t0 = now_ns();
+            if (b->keep_open) {
+                n = fds[a] < 0 ? -1 : pread(fds[a], buf, sizeof(buf), 0);
+            } else {
+                fd = open(b->paths[a], O_RDONLY);
+                n = fd < 0 ? -1 : read(fd, buf, sizeof(buf));
+                if (fd >= 0)
+                    close(fd);
+            }
+            w->lat[w->nlat++] = now_ns() - t0;
+            if (n <= 0)
+                w->errors++;
+        }
+    }
+
+    for (a = 0; a < b->nattrs; a++)
+        if (fds[a] >= 0)
+            close(fds[a]);
+    return NULL;
+}
+
+/* Print s as a JSON string literal */
+static void json_str(const char *s)
+{
+    const unsigned char *p;
+
+    putchar('"');
+    for (p = (const unsigned char *)s; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            printf("\\%c", *p);
+        else if (*p < 0x20)
+            printf("\\u%04x", *p);
+        else
+            putchar(*p);
+    }
+    putchar('"');
+}
+
+static uint64_t pct(const uint64_t *v, long n, double p)
+{
+    long i = (long)(p * (double)(n - 1) + 0.5);
+
+    return n ? v[i] : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-d HWMON_DIR] [-n ITERATIONS] [-t THREADS] [-k]\n"
+            "\n"
+            "  -d DIR   hwmon(-like) directory (default: hwmon named \"dchu\")\n"
+            "  -n N     passes over all sensor files per thread (default: 1000)\n"
+            "  -t N     concurrent reader threads (default: 1)\n"
+            "  -k       keep files open and pread() instead of open/read/close\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench b = { .iters = 1000, .threads = 1 };
+    struct worker *w;
+    uint64_t *all, t0, wall, sum = 0;
+    long total = 0, errors = 0, k;
+    int opt, i, a;
+
+    while ((opt = getopt(argc, argv, "d:n:t:kh")) != -1) {
+        switch (opt) {
+        case 'd': snprintf(b.dir, sizeof(b.dir), "%s", optarg); break;
+        case 'n': b.iters = strtol(optarg, NULL, 0); break;
+        case 't': b.threads = atoi(optarg); break;
+        case 'k': b.keep_open = 1; break;
+        case 'h': usage(argv[0]); return 0;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (b.iters < 1 || b.threads < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!b.dir[0] && find_dchu(b.dir, sizeof(b.dir))) {
+        fprintf(stderr, "no hwmon device named dchu; use -d\n");
+        return 1;
+    }
+    if (scan_attrs(&b)) {
+        fprintf(stderr, "%s: no fan*_input/pwmN/temp*_input files\n", b.dir);
+        return 1;
+    }
+
+    w = calloc(b.threads, sizeof(*w));
+    if (!w)
+        return 1;
+    for (i = 0; i < b.threads; i++) {
+        w[i].b = &b;
+        w[i].lat = malloc(sizeof(uint64_t) * b.iters * b.nattrs);
+        if (!w[i].lat)
+            return 1;
+    }
+
+    t0 = now_ns();
+    for (i = 0; i < b.threads; i++)
+        pthread_create(&w[i].tid, NULL, worker_run, &w[i]);
+    for (i = 0; i < b.threads; i++)
+        pthread_join(w[i].tid, NULL);
+    wall = now_ns() - t0;
+
+    for (i = 0; i < b.threads; i++)
+        total += w[i].nlat;
+    all = malloc(sizeof(uint64_t) * total);
+    if (!all)
+        return 1;
+    for (i = 0, k = 0; i < b.threads; i++) {
+        memcpy(all + k, w[i].lat, sizeof(uint64_t) * w[i].nlat);
+        k += w[i].nlat;
+        errors += w[i].errors;
+    }
+    qsort(all, total, sizeof(all[0]), cmp_u64);
+    for (k = 0; k < total; k++)
+        sum += all[k];
+
+    printf("{\"dir\":");
+    json_str(b.dir);
+    printf(",\"attrs\":[");
+    for (a = 0; a < b.nattrs; a++) {
+        if (a)
+            putchar(',');
+        json_str(b.attrs[a]);
+    }
+    printf("],\"threads\":%d,\"iterations\":%ld,\"mode\":\"%s\","
+           "\"reads\":%ld,\"errors\":%ld,\"wall_ns\":%llu,"
+           "\"reads_per_sec\":%.1f,\"lat_ns\":{\"min\":%llu,\"mean\":%llu,"
+           "\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+           b.threads, b.iters, b.keep_open ? "pread" : "open",
+           total, errors, (unsigned long long)wall,
+           wall ? (double)total * 1e9 / (double)wall : 0.0,
+           (unsigned long long)all[0],
+           (unsigned long long)(sum / total),
+           (unsigned long long)pct(all, total, 0.50),
+           (unsigned long long)pct(all, total, 0.99),
+           (unsigned long long)pct(all, total, 0.999),
+           (unsigned long long)all[total - 1]);
+
+    for (i = 0; i < b.threads; i++)
+        free(w[i].lat);
+    free(w);
+    free(all);
+    for (a = 0; a < b.nattrs; a++) {
+        free(b.attrs[a]);
+        free(b.paths[a]);
+    }
+    return errors ? 1 : 0;
+}
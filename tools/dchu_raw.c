@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * dchu-raw: issue arbitrary _DSM calls through /dev/dchu (DCHU_IOC_RAW_BATCH).
+ *
+ * Each CALL is FN or FN:HEXPAYLOAD (e.g. 61, 39:02000000); -f FROM-TO adds
+ * one call per function id in the range with the -p payload (TO is capped
+ * at the last id the _DSM 0 bitmap can list), so a full sweep is a single
+ * ioctl. Prints one line per call. Needs CAP_SYS_RAWIO.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include "../dchu_uapi.h"
+
+#define DSM_FUNCS 256   /* function ids covered by the _DSM 0 bitmap */
+
+struct calls {
+    struct dchu_raw_call *v;
+    size_t n, cap;
+};
+
+static struct dchu_raw_call *add_call(struct calls *c)
+{
+    struct dchu_raw_call *v;
+
+    if (c->n == c->cap) {
+        c->cap = c->cap ? 2 * c->cap : 64;
+        v = realloc(c->v, c->cap * sizeof(*v));
+        if (!v)
+            return NULL;
+        c->v = v;
+    }
+    v = &c->v[c->n++];
+    memset(v, 0, sizeof(*v));
+    return v;
+}
+
+/* "0a0b0c" -> bytes; returns length or -1 */
+static int parse_hex(const char *s, uint8_t *out)
+{
+    size_t len = strlen(s);
+    unsigned int byte;
+    size_t i;
+
+    if (len % 2 || len / 2 > DCHU_RAW_PAYLOAD_MAX)
+        return -1;
+    for (i = 0; i < len / 2; i++) {
+        if (sscanf(s + 2 * i, "%2x", &byte) != 1)
+            return -1;
+        out[i] = byte;
+    }
+    return (int)(len / 2);
+}
+
+static int parse_call(struct calls *c, const char *arg)
+{
+    struct dchu_raw_call *call = add_call(c);
+    const char *colon = strchr(arg, ':');
+    char *end;
+    int len = 0;
+
+    if (!call)
+        return -1;
+    call->function = strtoull(arg, &end, 0);
+    if (end == arg || (*end && end != colon))
+        return -1;
+    if (colon && (len = parse_hex(colon + 1, call->payload)) < 0)
+        return -1;
+    call->payload_len = len;
+    return 0;
+}
+
+static void print_call(const struct dchu_raw_call *c, int timing)
+{
+    uint32_t i, n;
+
+    printf("%llu", (unsigned long long)c->function);
+    if (timing)
+        printf(" %lluns", (unsigned long long)c->duration_ns);
+    if (c->status) {
+        printf(" err %d (%s)\n", c->status, strerror(-c->status));
+        return;
+    }
+    switch (c->type) {
+    case DCHU_RAW_INTEGER:
+        printf(" int 0x%llx\n", (unsigned long long)c->integer);
+        break;
+    case DCHU_RAW_BUFFER:
+        n = c->len < DCHU_RAW_BUF_MAX ? c->len : DCHU_RAW_BUF_MAX;
+        printf(" buf %u", c->len);
+        for (i = 0; i < n; i++)
+            printf(" %02x", c->buf[i]);
+        printf("\n");
+        break;
+    case DCHU_RAW_PACKAGE:
+        printf(" pkg %u\n", c->len);
+        break;
+    default:
+        printf(" type %u\n", c->type);
+        break;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-D DEV] [-t] [-f FROM-TO [-p HEX]] [CALL...]\n"
+            "\n"
+            "  CALL         FN or FN:HEXPAYLOAD, e.g. 61 or 39:02000000\n"
+            "  -f FROM-TO   sweep function ids FROM..TO (inclusive, TO <= 255)\n"
+            "  -p HEX       payload for the -f sweep (default: none)\n"
+            "  -t           print the firmware time of every call\n"
+            "  -D DEV       device node (default: /dev/dchu)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dev = "/dev/dchu", *sweep = NULL, *hex = "";
+    struct calls c = { 0 };
+    struct dchu_raw_batch batch = { 0 };
+    struct dchu_raw_call *call;
+    long long from, to, fn;
+    uint8_t payload[DCHU_RAW_PAYLOAD_MAX];
+    int opt, timing = 0, len, fd, i;
+    size_t done;
+
+    while ((opt = getopt(argc, argv, "D:f:p:th")) != -1) {
+        switch (opt) {
+        case 'D': dev = optarg; break;
+        case 'f': sweep = optarg; break;
+        case 'p': hex = optarg; break;
+        case 't': timing = 1; break;
+        case 'h': usage(argv[0]); return 0;
+        default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (sweep) {
+        len = parse_hex(hex, payload);
+        if (sscanf(sweep, "%lli-%lli", &from, &to) != 2 || len < 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (to > DSM_FUNCS - 1)
+            to = DSM_FUNCS - 1;
+        if (from < 0 || from > to) {
+            fprintf(stderr, "bad range: %s (ids 0-%d)\n", sweep, DSM_FUNCS - 1);
+            return 2;
+        }
+        for (fn = from; fn <= to; fn++) {
+            call = add_call(&c);
+            if (!call)
+                return 1;
+            call->function = fn;
+            call->payload_len = len;
+            memcpy(call->payload, payload, len);
+        }
+    }
+    for (i = optind; i < argc; i++) {
+        if (parse_call(&c, argv[i])) {
+            fprintf(stderr, "bad call: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!c.n) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    fd = open(dev, O_RDONLY);
+    if (fd < 0) {
+        perror(dev);
+        return 1;
+    }
+    for (done = 0; done < c.n; done += batch.nr) {
+        batch.nr = c.n - done < DCHU_RAW_BATCH_MAX ? c.n - done : DCHU_RAW_BATCH_MAX;
+        batch.calls = (uintptr_t)(c.v + done);
+        if (ioctl(fd, DCHU_IOC_RAW_BATCH, &batch)) {
+            perror("DCHU_IOC_RAW_BATCH");
+            return 1;
+        }
+    }
+    close(fd);
+
+    for (done = 0; done < c.n; done++)
+        print_call(&c.v[done], timing);
+    free(c.v);
+    return 0;
+}